@@ -0,0 +1,347 @@
+/*
+	Batching of thumbnails into padded atlases. For small inputs the fixed cost of each call (dispatch, allocation,
+	thread start, the contour vectors) outweighs the filtering itself, so many images share one call.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "main.h"
+#include "atlas.h"
+#include "thinning.h"
+#include "perfcounters.h"
+#include "runlog.h"
+#include "smoothing.h"
+
+/*
+	Where one image lives in the atlas: core is the image itself, outer the core plus its padding.
+	- Pavel Shekhter
+*/
+struct ATLASSLOT {
+	cv::Rect core;
+	cv::Rect outer;
+};
+
+/*
+	Per-image results of one variant in a batch.
+	- Pavel Shekhter
+*/
+struct ATLASRESULT {
+	int contourCount = 0;
+	long long contourPoints = 0;
+};
+
+static double nowMs() {
+	return (cv::getTickCount()) / (cv::getTickFrequency()) * 1000;
+}
+
+/*
+	Padding around each image: the widest halo of any single filter, since the padding is refilled after every
+	stage that changes the atlas. A recursive Gaussian runs per slot and needs none.
+	- Pavel Shekhter
+*/
+static int atlasPad() {
+	int blur = std::max(id.canny_blurSize, std::max(id.laplace_blurSize, id.sobel_blurSize)) / 2;
+	return std::max(1, std::max(blur, std::max(id.laplace_kernel / 2, id.canny_Kernel / 2)));
+}
+
+/*
+	Refills a slot's padding from its core with the given border mode, exactly as a filter would extend the image
+	on its own. Rows are filled first, then whole padded rows are copied so the corners match too.
+	- Pavel Shekhter
+*/
+static void fillBorder(cv::Mat &atlas, const ATLASSLOT &slot, int borderType) {
+	int pad = slot.core.x - slot.outer.x;
+	int w = slot.core.width, h = slot.core.height;
+	for (int y = 0; y < h; ++y) {
+		uchar *row = atlas.ptr(slot.core.y + y) + slot.core.x;
+		for (int i = 1; i <= pad; ++i) {
+			row[-i] = row[cv::borderInterpolate(-i, w, borderType)];
+			row[w - 1 + i] = row[cv::borderInterpolate(w - 1 + i, w, borderType)];
+		}
+	}
+	for (int i = 1; i <= pad; ++i) {
+		const uchar *top = atlas.ptr(slot.core.y + cv::borderInterpolate(-i, h, borderType)) + slot.outer.x;
+		const uchar *bottom = atlas.ptr(slot.core.y + cv::borderInterpolate(h - 1 + i, h, borderType)) + slot.outer.x;
+		std::copy(top, top + slot.outer.width, atlas.ptr(slot.core.y - i) + slot.outer.x);
+		std::copy(bottom, bottom + slot.outer.width, atlas.ptr(slot.core.y + h - 1 + i) + slot.outer.x);
+	}
+}
+
+static void fillBorders(cv::Mat &atlas, const std::vector<ATLASSLOT> &slots, int borderType) {
+	for (size_t s = 0; s < slots.size(); ++s) {
+		fillBorder(atlas, slots[s], borderType);
+	}
+}
+
+/*
+	Shelf-packs the padded images, tallest first, into rows no wider than --atlas-width (or the widest image).
+	Returns the atlas size.
+	- Pavel Shekhter
+*/
+static cv::Size packSlots(const std::vector<cv::Mat> &images, int pad, std::vector<ATLASSLOT> &slots) {
+	std::vector<int> order(images.size());
+	int width = opts.atlasWidth;
+	for (size_t i = 0; i < images.size(); ++i) {
+		order[i] = (int)i;
+		width = std::max(width, images[i].cols + 2 * pad);
+	}
+	std::sort(order.begin(), order.end(), [&images](int a, int b) { return images[a].rows > images[b].rows; });
+
+	slots.assign(images.size(), ATLASSLOT());
+	int x = 0, y = 0, shelf = 0;
+	for (size_t n = 0; n < order.size(); ++n) {
+		const cv::Mat &image = images[order[n]];
+		int outerW = image.cols + 2 * pad, outerH = image.rows + 2 * pad;
+		if (x + outerW > width) {
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		slots[order[n]].outer = cv::Rect(x, y, outerW, outerH);
+		slots[order[n]].core = cv::Rect(x + pad, y + pad, image.cols, image.rows);
+		x += outerW;
+		shelf = std::max(shelf, outerH);
+	}
+	return cv::Size(width, y + shelf);
+}
+
+/*
+	Traces the contours of every slot's edge map with one findContours call. The padding is zeroed, which is how
+	findContours extends a single image, so no contour crosses from one image into another. A contour belongs to
+	the slot its first point is in.
+	- Pavel Shekhter
+*/
+static void atlasContours(const cv::Mat &edges, const std::vector<ATLASSLOT> &slots, const cv::Mat &slotIndex,
+	std::vector<ATLASRESULT> &results) {
+	cv::Mat traced = cv::Mat::zeros(edges.size(), CV_8UC1);
+	for (size_t s = 0; s < slots.size(); ++s) {
+		cv::Mat core = traced(slots[s].core);
+		edges(slots[s].core).copyTo(core);
+	}
+
+	std::vector<cv::Vec4i> hierarchy;
+	std::vector<std::vector<cv::Point>> contours;
+	cv::findContours(traced, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_SIMPLE, cv::Point(0, 0));
+
+	results.assign(slots.size(), ATLASRESULT());
+	for (size_t i = 0; i < contours.size(); ++i) {
+		int s = slotIndex.at<int>(contours[i][0].y, contours[i][0].x);
+		results[s].contourCount++;
+		results[s].contourPoints += contours[i].size();
+	}
+}
+
+/*
+	A variant's smoothing of the atlas into dst (which may be the atlas). Filters with a finite kernel run once over
+	the whole atlas; the recursive Gaussian reaches across the padding into the neighbouring slots, so it runs on
+	each slot's core on its own.
+	- Pavel Shekhter
+*/
+static void atlasSmooth(const cv::Mat &atlas, cv::Mat &dst, const std::vector<ATLASSLOT> &slots, SMOOTHTYPE type, int size, double sigma) {
+	if (!smoothNeedsWholeImage(type, size, sigma)) {
+		smoothImage(atlas, dst, type, size, sigma);
+		return;
+	}
+	if (dst.data != atlas.data) {
+		atlas.copyTo(dst);
+	}
+	for (size_t s = 0; s < slots.size(); ++s) {
+		cv::Mat core = dst(slots[s].core);
+		smoothImage(core, core, type, size, sigma);
+	}
+}
+
+/*
+	Canny for every slot. The blur runs once over the atlas; the padding of the blurred atlas is then refilled the
+	way Canny extends an image, and the edge tracking runs per slot so hysteresis cannot link edges of two images.
+	Like the Canny detectors, the result is the frame's grey levels where there are edges.
+	- Pavel Shekhter
+*/
+static void atlasCanny(const VARIANT &variant, const cv::Mat &atlas, const std::vector<ATLASSLOT> &slots, cv::Mat &edges) {
+	cv::Mat blurred;
+	int size;
+	double sigma;
+	SMOOTHTYPE type = variantSmoothing(variant, size, sigma);
+	atlasSmooth(atlas, blurred, slots, type, size, sigma);
+	fillBorders(blurred, slots, cv::BORDER_REPLICATE);
+
+	edges = cv::Mat::zeros(atlas.size(), CV_8UC1);
+	cv::Mat mask;
+	for (size_t s = 0; s < slots.size(); ++s) {
+		cv::Canny(blurred(slots[s].core), mask, id.canny_lowThresh, id.canny_lowThresh * id.canny_Ratio, id.canny_Kernel);
+		cv::Mat core = edges(slots[s].core);
+		atlas(slots[s].core).copyTo(core, mask);
+	}
+}
+
+/*
+	Sobel gradients over the whole atlas, combined as in the Sobel detectors, then thinned per slot with --thin.
+	- Pavel Shekhter
+*/
+static void atlasSobel(const cv::Mat &atlas, const std::vector<ATLASSLOT> &slots, cv::Mat &edges) {
+	cv::Mat gradX, gradY, absX, absY;
+	cv::Sobel(atlas, gradX, id.sobel_ddepth, 1, 0, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
+	cv::convertScaleAbs(gradX, absX);
+	cv::Sobel(atlas, gradY, id.sobel_ddepth, 0, 1, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
+	cv::convertScaleAbs(gradY, absY);
+	cv::addWeighted(absX, 0.5, absY, 0.5, 0, edges);
+
+	if (opts.thinMode != THIN_NONE) {
+		for (size_t s = 0; s < slots.size(); ++s) {
+			cv::Mat core = edges(slots[s].core);
+			cv::Mat thin = core;
+			thinGradient(gradX(slots[s].core), gradY(slots[s].core), thin);
+			thin.copyTo(core);
+		}
+	}
+}
+
+/*
+	Laplacian over the whole atlas, as in the Laplacian detectors, then thinned per slot with --thin.
+	- Pavel Shekhter
+*/
+static void atlasLaplace(const cv::Mat &atlas, const std::vector<ATLASSLOT> &slots, cv::Mat &edges) {
+	cv::Mat laplacian;
+	cv::Laplacian(atlas, laplacian, id.laplace_ddepth, id.laplace_kernel, id.laplace_scale, id.laplace_delta, cv::BORDER_DEFAULT);
+	cv::convertScaleAbs(laplacian, edges);
+
+	if (opts.thinMode != THIN_NONE) {
+		for (size_t s = 0; s < slots.size(); ++s) {
+			cv::Mat core = edges(slots[s].core);
+			cv::Mat thin = core;
+			thinZeroCrossings(laplacian(slots[s].core), thin);
+			thin.copyTo(core);
+		}
+	}
+}
+
+/*
+	Gabor normalises its response over the whole image, so it cannot share a call; each slot runs the Gabor
+	detector on its own and keeps that detector's contour statistics.
+	- Pavel Shekhter
+*/
+static void atlasGabor(const cv::Mat &atlas, const std::vector<ATLASSLOT> &slots, cv::Mat &edges, std::vector<ATLASRESULT> &results) {
+	cv::Mat det, noColor;
+	edges = cv::Mat::zeros(atlas.size(), CV_8UC1);
+	results.assign(slots.size(), ATLASRESULT());
+	for (size_t s = 0; s < slots.size(); ++s) {
+		id.currentFrameGry = atlas(slots[s].core).clone();
+		gabor(const_cast<char *>("atlas"), det, noColor);
+		cv::Mat core = edges(slots[s].core);
+		det.copyTo(core);
+		results[s].contourCount = id.contourCount;
+		results[s].contourPoints = id.contourPoints;
+	}
+	id.currentFrameGry = atlas;
+}
+
+int runAtlasBatch(std::ofstream &file, const std::vector<std::string> &imagefiles, int firstIndex, int trial) {
+	std::vector<const VARIANT *> chosen;
+	if (!parseVariantList(opts.variantList, chosen)) {
+		appendErrorMessage(file, -2);
+		return -2;
+	}
+
+	double initTime = nowMs();
+	std::vector<cv::Mat> images(imagefiles.size());
+	for (size_t i = 0; i < imagefiles.size(); ++i) {
+		images[i] = cv::imread(imagefiles[i], decodeFlag(true, opts.analysisScale));
+		if (images[i].empty()) {
+			std::cout << "Can't open file!" << std::endl;
+			file << "Can't open " << imagefiles[i] << "\n";
+			appendErrorMessage(file, -1);
+			return -1;
+		}
+	}
+
+	int pad = atlasPad();
+	std::vector<ATLASSLOT> slots;
+	cv::Mat atlas = cv::Mat::zeros(packSlots(images, pad, slots), CV_8UC1);
+	cv::Mat slotIndex(atlas.size(), CV_32S, cv::Scalar::all(0));
+	for (size_t s = 0; s < slots.size(); ++s) {
+		cv::Mat core = atlas(slots[s].core);
+		images[s].copyTo(core);
+		slotIndex(slots[s].outer).setTo(cv::Scalar::all((double)s));
+	}
+	fillBorders(atlas, slots, cv::BORDER_REFLECT_101);
+	double decodeTime = nowMs() - initTime;
+
+	file << "Batch of " << slots.size() << " images in a " << atlas.cols << "x" << atlas.rows << " atlas with " << pad
+		<< " pixels of padding, decoded and packed in " << decodeTime << " ms.\n";
+
+	// Stages run per slot (thinning, Gabor) are logged against the batch, under its first file
+	setRunContext(trial, firstIndex, imagefiles[0]);
+
+	// The detectors' in-place smoothing is applied to the atlas in the same order as the trials apply it to a frame
+	id.currentFrameColor.release();
+	id.currentFrameGry = atlas;
+
+	std::vector<double> times(chosen.size(), 0), starts(chosen.size(), 0);
+	std::vector<std::vector<ATLASRESULT> > results(chosen.size());
+	for (size_t v = 0; v < chosen.size(); ++v) {
+		const VARIANT &variant = *chosen[v];
+		PERFSCOPE perf;
+		perfBegin(perf, variant.name, "atlas", (double)atlas.total());
+		double variantStart = nowMs();
+		starts[v] = runClock();
+
+		cv::Mat edges;
+		if (variant.detect == &gabor) {
+			atlasGabor(atlas, slots, edges, results[v]);
+		}
+		else {
+			int size;
+			double sigma;
+			variantSmoothing(variant, size, sigma);
+			atlasSmooth(atlas, atlas, slots, variant.smooth, size, sigma);
+			if (variant.smooth != SMOOTH_NONE) {
+				fillBorders(atlas, slots, cv::BORDER_REFLECT_101);
+			}
+			if (variant.detect == &gaussianCanny || variant.detect == &normalizedCanny || variant.detect == &boxCanny) {
+				atlasCanny(variant, atlas, slots, edges);
+			}
+			else if (variant.detect == &gaussianSobel || variant.detect == &normalizedSobel || variant.detect == &boxSobel) {
+				atlasSobel(atlas, slots, edges);
+			}
+			else {
+				atlasLaplace(atlas, slots, edges);
+			}
+			atlasContours(edges, slots, slotIndex, results[v]);
+		}
+		times[v] = nowMs() - variantStart;
+		perfEnd(perf);
+
+		std::vector<int> comp_params;
+		comp_params.push_back(CV_IMWRITE_JPEG_QUALITY);
+		comp_params.push_back(100);
+		for (size_t s = 0; s < slots.size(); ++s) {
+			std::string imp = boost::filesystem::path(imagefiles[s]).filename().generic_string();
+			cv::Mat inverted;
+			cv::bitwise_not(edges(slots[s].core), inverted);
+			if (!cv::imwrite("trial_" + std::to_string(trial) + "_" + variant.output + "_" + imp, edges(slots[s].core), comp_params)
+				|| !cv::imwrite("trial_" + std::to_string(trial) + "_" + variant.name + "_inv_" + imp, inverted, comp_params)) {
+				appendErrorMessage(file, -3);
+			}
+		}
+
+		file << variant.name << " took " << times[v] << " ms for the batch, " << times[v] / slots.size() << " ms per image.\n";
+		for (size_t s = 0; s < slots.size(); ++s) {
+			file << "  " << imagefiles[s] << ": " << results[v][s].contourCount << " contours with " << results[v][s].contourPoints << " points.\n";
+		}
+	}
+
+	for (size_t s = 0; s < slots.size(); ++s) {
+		setRunContext(trial, firstIndex + (int)s, imagefiles[s]);
+		for (size_t v = 0; v < chosen.size(); ++v) {
+			logStage(chosen[v]->name, "detect", starts[v], times[v] / slots.size(), results[v][s].contourCount);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+	Runs the chosen variants (--variants, default all) on a batch of small images packed into one greyscale atlas,
+	so the smoothing, Sobel, Laplacian and contour tracing are each called once per batch instead of once per image.
+	Every image sits in a slot padded with its own reflected border, wide enough for the largest kernel halo, so the
+	per-image edge maps and contour statistics are identical to processing the images one at a time with --gray.
+	Each image's edge map and its inverse are written under the names the trials give them with --gray, which has no
+	colour frame to mark, so there are no _marked_ images.
+	Logs one run log row per image, starting at "File #firstIndex", with the batch time split evenly between images.
+	Returns 0 on success or an error code as for appendErrorMessage.
+	- Pavel Shekhter
+*/
+int runAtlasBatch(std::ofstream &file, const std::vector<std::string> &imagefiles, int firstIndex, int trial);
@@ -0,0 +1,200 @@
+/*
+	Baseline comparison with a rank-based significance test, so OpenCV upgrades and parameter changes can be checked
+	for slowdowns without eyeballing two CSVs.
+	- Pavel Shekhter
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "main.h"
+#include "compare.h"
+
+typedef std::map<std::string, std::vector<double> > SAMPLES;
+
+/*
+	One row of the comparison table.
+	- Pavel Shekhter
+*/
+struct COMPARISON {
+	std::string key;
+	int baseCount;
+	int newCount;
+	double baseMedian;
+	double newMedian;
+	double change;      // relative change of the median, positive is slower
+	double pValue;
+	double rankBiserial; // effect size from U, in [-1, 1], positive is slower
+	int verdict;        // 1 regression, -1 improvement, 0 no significant change
+};
+
+static std::string trim(const std::string &text) {
+	size_t first = text.find_first_not_of(" \t\r");
+	if (first == std::string::npos) {
+		return "";
+	}
+	size_t last = text.find_last_not_of(" \t\r");
+	return text.substr(first, last - first + 1);
+}
+
+/*
+	Reads a results CSV into samples keyed by "image variant stage". The first column is "Trial #t File #f (image)",
+	and the image path is the key, so reordering the images between runs still compares each image with itself;
+	repeats of an image are further samples of the same key. CSVs written before the path was added are keyed by
+	"File #f", the image's place on the command line. The remaining columns follow the variant order of setUpFile;
+	empty cells (variants that did not run) are skipped.
+	Returns false if the file cannot be opened.
+	- Pavel Shekhter
+*/
+static bool readResults(const std::string &path, SAMPLES &samples) {
+	std::ifstream in(path);
+	if (!in.is_open()) {
+		std::cout << "Can't open results file " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream cells(line);
+		std::string label;
+		std::getline(cells, label, ',');
+		size_t filePos = label.find("File #");
+		if (filePos == std::string::npos) {
+			continue;  // header or blank separator line
+		}
+		std::string image = trim(label.substr(filePos));
+		size_t open = label.find(" (", filePos);
+		size_t close = label.rfind(')');
+		if (open != std::string::npos && close != std::string::npos && close > open) {
+			image = label.substr(open + 2, close - open - 2);
+		}
+
+		std::string cell;
+		for (int v = 0; v < variantCount && std::getline(cells, cell, ','); ++v) {
+			cell = trim(cell);
+			if (cell.empty()) {
+				continue;
+			}
+			samples[image + " " + variants[v].name + " detect"].push_back(std::atof(cell.c_str()));
+		}
+	}
+	return true;
+}
+
+static double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	size_t n = values.size();
+	return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/*
+	Two-sided Mann-Whitney U test using the normal approximation with tie and continuity corrections.
+	Sets u to the U statistic of the new samples and returns the p-value.
+	- Pavel Shekhter
+*/
+static double mannWhitney(const std::vector<double> &base, const std::vector<double> &now, double &u) {
+	size_t n1 = base.size(), n2 = now.size();
+	std::vector<std::pair<double, int> > all;
+	for (size_t i = 0; i < n1; ++i) all.push_back(std::make_pair(base[i], 0));
+	for (size_t i = 0; i < n2; ++i) all.push_back(std::make_pair(now[i], 1));
+	std::sort(all.begin(), all.end());
+
+	// Average ranks over ties, and collect the tie correction term
+	double rankSumNew = 0, tieTerm = 0;
+	size_t n = all.size();
+	for (size_t i = 0; i < n;) {
+		size_t j = i;
+		while (j < n && all[j].first == all[i].first) {
+			++j;
+		}
+		double rank = (i + 1 + j) / 2.0;
+		for (size_t k = i; k < j; ++k) {
+			if (all[k].second == 1) {
+				rankSumNew += rank;
+			}
+		}
+		double t = (double)(j - i);
+		tieTerm += t * t * t - t;
+		i = j;
+	}
+
+	u = rankSumNew - n2 * (n2 + 1) / 2.0;
+	double mean = n1 * n2 / 2.0;
+	double variance = n1 * n2 / 12.0 * ((n + 1) - tieTerm / (n * (n - 1.0)));
+	if (variance <= 0) {
+		return 1.0;
+	}
+	double z = (std::fabs(u - mean) - 0.5) / std::sqrt(variance);
+	if (z < 0) {
+		z = 0;
+	}
+	return std::erfc(z / std::sqrt(2.0));
+}
+
+int runCompare() {
+	SAMPLES base, now;
+	if (!readResults(opts.baselineFile, base) || !readResults(opts.compareFile, now)) {
+		appendErrorMessage(std::cout, -1);
+		return -1;
+	}
+
+	std::vector<COMPARISON> rows;
+	int unmatched = 0;
+	for (SAMPLES::const_iterator it = now.begin(); it != now.end(); ++it) {
+		SAMPLES::const_iterator match = base.find(it->first);
+		if (match == base.end()) {
+			unmatched++;
+			continue;
+		}
+		const std::vector<double> &b = match->second;
+		const std::vector<double> &n = it->second;
+
+		COMPARISON row;
+		row.key = it->first;
+		row.baseCount = (int)b.size();
+		row.newCount = (int)n.size();
+		row.baseMedian = median(b);
+		row.newMedian = median(n);
+		row.change = row.baseMedian > 0 ? row.newMedian / row.baseMedian - 1 : 0;
+		double u;
+		row.pValue = mannWhitney(b, n, u);
+		row.rankBiserial = 2 * u / ((double)b.size() * n.size()) - 1;
+		row.verdict = 0;
+		if (row.pValue < opts.compareAlpha && std::fabs(row.change) > opts.compareEffect) {
+			row.verdict = row.change > 0 ? 1 : -1;
+		}
+		rows.push_back(row);
+	}
+
+	std::sort(rows.begin(), rows.end(), [](const COMPARISON &a, const COMPARISON &b) { return a.change > b.change; });
+
+	int regressions = 0, improvements = 0;
+	printf("%-36s %6s %6s %12s %12s %9s %9s %7s  %s\n", "Image / variant / stage", "n base", "n new", "base median", "new median",
+		"change", "p", "r", "verdict");
+	for (size_t i = 0; i < rows.size(); ++i) {
+		const COMPARISON &row = rows[i];
+		const char *verdict = row.verdict > 0 ? "REGRESSION" : row.verdict < 0 ? "improvement" : "";
+		printf("%-36s %6d %6d %12.3f %12.3f %8.1f%% %9.4f %7.3f  %s\n", row.key.c_str(), row.baseCount, row.newCount,
+			row.baseMedian, row.newMedian, row.change * 100, row.pValue, row.rankBiserial, verdict);
+		regressions += row.verdict > 0;
+		improvements += row.verdict < 0;
+	}
+
+	printf("\n%d compared, %d regressions, %d improvements (alpha %.3f, effect threshold %.1f%%).\n", (int)rows.size(), regressions,
+		improvements, opts.compareAlpha, opts.compareEffect * 100);
+	if (rows.empty()) {
+		std::cout << "No (image, variant, stage) appears in both files." << std::endl;
+	}
+	unmatched += (int)(base.size() - rows.size());
+	if (unmatched > 0) {
+		std::cout << unmatched << " (image, variant, stage) keys appear in only one file and were not compared." << std::endl;
+	}
+	return regressions > 0 ? 1 : 0;
+}
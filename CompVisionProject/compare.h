@@ -0,0 +1,11 @@
+#pragma once
+
+/*
+	Compares a new results CSV (--compare=FILE) against a saved baseline (--baseline=FILE), both in the format written
+	by setUpFile and the trials. Timings are matched per (image, variant, stage) and each pair of samples is tested with
+	a two-sided Mann-Whitney U test. A change counts when p < --alpha and the medians differ by more than --effect
+	(a fraction, e.g. 0.05 for 5%). Prints the changes ranked from worst regression to best improvement.
+	Returns 1 if any variant regressed, 0 if none did, or the error code if a file could not be read.
+	- Pavel Shekhter
+*/
+int runCompare();
@@ -0,0 +1,349 @@
+/*
+	Hough transform stage used to benchmark the edge detectors: how many lines and circles each detector's edge map
+	yields, and how the cost of voting grows with the number of edge pixels it produces.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "main.h"
+#include "hough.h"
+#include "runlog.h"
+
+/*
+	Per-variant totals for the edge density report.
+	- Pavel Shekhter
+*/
+struct HOUGHTOTALS {
+	int runs = 0;
+	double density = 0;
+	double edgePixels = 0;
+	double time = 0;
+};
+
+static std::map<std::string, HOUGHTOTALS> houghTotals;
+static std::mutex houghTotalsLock;
+
+static double nowMs() {
+	return (cv::getTickCount()) / (cv::getTickFrequency()) * 1000;
+}
+
+/*
+	Each stripe of edge points votes into its own line accumulator, so threads never contend on a cell.
+	Accumulators have a one-cell border so peaks can be compared with their neighbours without bounds checks.
+	- Pavel Shekhter
+*/
+class LineVoter : public cv::ParallelLoopBody {
+public:
+	LineVoter(const std::vector<cv::Point> &points, const std::vector<float> &cosTab, const std::vector<float> &sinTab,
+		int numRho, std::vector<std::vector<int> > &accums)
+		: points(points), cosTab(cosTab), sinTab(sinTab), numRho(numRho), accums(accums) {}
+
+	void operator()(const cv::Range &range) const {
+		int numAngle = (int)cosTab.size();
+		int stripes = (int)accums.size();
+		for (int s = range.start; s < range.end; ++s) {
+			std::vector<int> &accum = accums[s];
+			accum.assign((numAngle + 2) * (numRho + 2), 0);
+			size_t first = points.size() * s / stripes;
+			size_t last = points.size() * (s + 1) / stripes;
+			for (size_t p = first; p < last; ++p) {
+				for (int n = 0; n < numAngle; ++n) {
+					int r = cvRound(points[p].x * cosTab[n] + points[p].y * sinTab[n]) + (numRho - 1) / 2;
+					accum[(n + 1) * (numRho + 2) + r + 1]++;
+				}
+			}
+		}
+	}
+
+private:
+	const std::vector<cv::Point> &points;
+	const std::vector<float> &cosTab;
+	const std::vector<float> &sinTab;
+	int numRho;
+	std::vector<std::vector<int> > &accums;
+};
+
+/*
+	Each stripe of edge points votes for the centres of circles of one radius, using a precomputed table of offsets.
+	- Pavel Shekhter
+*/
+class CircleVoter : public cv::ParallelLoopBody {
+public:
+	CircleVoter(const std::vector<cv::Point> &points, const std::vector<cv::Point> &offsets, cv::Size size,
+		std::vector<std::vector<int> > &accums)
+		: points(points), offsets(offsets), size(size), accums(accums) {}
+
+	void operator()(const cv::Range &range) const {
+		int stripes = (int)accums.size();
+		int stride = size.width + 2;
+		for (int s = range.start; s < range.end; ++s) {
+			std::vector<int> &accum = accums[s];
+			accum.assign((size.height + 2) * stride, 0);
+			size_t first = points.size() * s / stripes;
+			size_t last = points.size() * (s + 1) / stripes;
+			for (size_t p = first; p < last; ++p) {
+				for (size_t k = 0; k < offsets.size(); ++k) {
+					int cx = points[p].x + offsets[k].x;
+					int cy = points[p].y + offsets[k].y;
+					if (cx >= 0 && cy >= 0 && cx < size.width && cy < size.height) {
+						accum[(cy + 1) * stride + cx + 1]++;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	const std::vector<cv::Point> &points;
+	const std::vector<cv::Point> &offsets;
+	cv::Size size;
+	std::vector<std::vector<int> > &accums;
+};
+
+/*
+	Sums the per-thread accumulators into the first one, in parallel over the cells.
+	- Pavel Shekhter
+*/
+class AccumulatorMerger : public cv::ParallelLoopBody {
+public:
+	AccumulatorMerger(std::vector<std::vector<int> > &accums) : accums(accums) {}
+
+	void operator()(const cv::Range &range) const {
+		std::vector<int> &total = accums[0];
+		for (size_t a = 1; a < accums.size(); ++a) {
+			const std::vector<int> &part = accums[a];
+			for (int i = range.start; i < range.end; ++i) {
+				total[i] += part[i];
+			}
+		}
+	}
+
+private:
+	std::vector<std::vector<int> > &accums;
+};
+
+/*
+	Sums the accumulators into the first, in one band of cells per thread.
+	- Pavel Shekhter
+*/
+static void mergeAccumulators(std::vector<std::vector<int> > &accums) {
+	if (accums.size() > 1) {
+		cv::parallel_for_(cv::Range(0, (int)accums[0].size()), AccumulatorMerger(accums), cv::getNumThreads());
+	}
+}
+
+/*
+	Collects the edge points, keeping only a --hough-sample fraction of them when sampling is on.
+	- Pavel Shekhter
+*/
+static void collectEdgePoints(const cv::Mat &edges, std::vector<cv::Point> &points, HOUGHRESULT &result) {
+	cv::RNG rng(12345);
+	bool sample = opts.houghSample < 1.0;
+	for (int y = 0; y < edges.rows; ++y) {
+		const uchar *row = edges.ptr<uchar>(y);
+		for (int x = 0; x < edges.cols; ++x) {
+			if (row[x] > opts.houghEdgeThreshold) {
+				result.edgePixels++;
+				if (!sample || rng.uniform(0.0, 1.0) < opts.houghSample) {
+					points.push_back(cv::Point(x, y));
+				}
+			}
+		}
+	}
+	result.sampledPixels = (int)points.size();
+	result.edgeDensity = edges.total() > 0 ? (double)result.edgePixels / edges.total() : 0;
+}
+
+/*
+	Number of voting stripes: one per thread, but no more than there are chunks of a few thousand points.
+	- Pavel Shekhter
+*/
+static int stripeCount(size_t points) {
+	return std::max(1, std::min(cv::getNumThreads(), (int)(points / 4096) + 1));
+}
+
+/*
+	Votes for lines and picks the local maxima above the vote threshold, strongest first.
+	- Pavel Shekhter
+*/
+static void houghLines(const std::vector<cv::Point> &points, cv::Size size, HOUGHRESULT &result) {
+	const double rhoStep = 1.0;
+	const double thetaStep = CV_PI / 180;
+	int numAngle = cvRound(CV_PI / thetaStep);
+	int numRho = cvRound(((size.width + size.height) * 2 + 1) / rhoStep);
+	int threshold = std::max(1, cvRound(opts.houghThreshold * std::min(1.0, opts.houghSample)));
+
+	std::vector<float> cosTab(numAngle), sinTab(numAngle);
+	for (int n = 0; n < numAngle; ++n) {
+		cosTab[n] = (float)(std::cos(n * thetaStep) / rhoStep);
+		sinTab[n] = (float)(std::sin(n * thetaStep) / rhoStep);
+	}
+
+	double start = nowMs();
+	std::vector<std::vector<int> > accums(stripeCount(points.size()));
+	cv::parallel_for_(cv::Range(0, (int)accums.size()), LineVoter(points, cosTab, sinTab, numRho, accums), (double)accums.size());
+	result.voteTime += nowMs() - start;
+
+	start = nowMs();
+	mergeAccumulators(accums);
+	const std::vector<int> &accum = accums[0];
+
+	std::vector<std::pair<int, int> > peaks;
+	for (int n = 0; n < numAngle; ++n) {
+		for (int r = 0; r < numRho; ++r) {
+			int base = (n + 1) * (numRho + 2) + r + 1;
+			int votes = accum[base];
+			if (votes > threshold && votes > accum[base - 1] && votes >= accum[base + 1] &&
+				votes > accum[base - numRho - 2] && votes >= accum[base + numRho + 2]) {
+				peaks.push_back(std::make_pair(votes, base));
+			}
+		}
+	}
+	std::sort(peaks.begin(), peaks.end(), std::greater<std::pair<int, int> >());
+
+	for (size_t i = 0; i < peaks.size() && (int)i < opts.houghMaxResults; ++i) {
+		int n = peaks[i].second / (numRho + 2) - 1;
+		int r = peaks[i].second - (n + 1) * (numRho + 2) - 1;
+		result.lines.push_back(cv::Vec2f((float)((r - (numRho - 1) * 0.5) * rhoStep), (float)(n * thetaStep)));
+	}
+	result.peakTime += nowMs() - start;
+}
+
+/*
+	Votes for circle centres one radius at a time and keeps the strongest local maxima over all radii.
+	A centre needs votes from --hough-circle-ratio of the circumference to count. Each radius costs a vote per
+	circumference pixel per edge point and a full accumulator scan, so the radii are bounded (10 to 100 by default).
+	- Pavel Shekhter
+*/
+static void houghCircles(const std::vector<cv::Point> &points, cv::Size size, HOUGHRESULT &result) {
+	int maxRadius = opts.houghMaxRadius > 0 ? opts.houghMaxRadius : std::min(size.width, size.height) / 2;
+	std::vector<std::pair<int, cv::Vec3f> > found;
+	std::vector<std::vector<int> > accums(stripeCount(points.size()));
+	int stride = size.width + 2;
+
+	for (int radius = std::max(1, opts.houghMinRadius); radius <= maxRadius; radius += std::max(1, opts.houghRadiusStep)) {
+		// Offsets from an edge point to the centres it votes for, with duplicates from rounding removed
+		int steps = std::max(8, cvRound(2 * CV_PI * radius));
+		std::vector<cv::Point> offsets;
+		for (int k = 0; k < steps; ++k) {
+			cv::Point offset(cvRound(radius * std::cos(2 * CV_PI * k / steps)), cvRound(radius * std::sin(2 * CV_PI * k / steps)));
+			if (offsets.empty() || !(offsets.back().x == offset.x && offsets.back().y == offset.y)) {
+				offsets.push_back(offset);
+			}
+		}
+		int threshold = std::max(1, cvRound(opts.houghCircleRatio * offsets.size() * std::min(1.0, opts.houghSample)));
+
+		double start = nowMs();
+		cv::parallel_for_(cv::Range(0, (int)accums.size()), CircleVoter(points, offsets, size, accums), (double)accums.size());
+		result.voteTime += nowMs() - start;
+
+		start = nowMs();
+		mergeAccumulators(accums);
+		const std::vector<int> &accum = accums[0];
+		for (int y = 0; y < size.height; ++y) {
+			for (int x = 0; x < size.width; ++x) {
+				int base = (y + 1) * stride + x + 1;
+				int votes = accum[base];
+				if (votes > threshold && votes > accum[base - 1] && votes >= accum[base + 1] &&
+					votes > accum[base - stride] && votes >= accum[base + stride]) {
+					found.push_back(std::make_pair(votes, cv::Vec3f((float)x, (float)y, (float)radius)));
+				}
+			}
+		}
+		result.peakTime += nowMs() - start;
+	}
+
+	std::stable_sort(found.begin(), found.end(), [](const std::pair<int, cv::Vec3f> &a, const std::pair<int, cv::Vec3f> &b) {
+		return a.first > b.first;
+	});
+	for (size_t i = 0; i < found.size() && (int)i < opts.houghMaxResults; ++i) {
+		result.circles.push_back(found[i].second);
+	}
+}
+
+HOUGHRESULT houghTransform(const cv::Mat &edges) {
+	HOUGHRESULT result;
+	cv::Mat gray = edges;
+	if (edges.type() != CV_8UC1) {
+		edges.convertTo(gray, CV_8U);
+	}
+
+	double start = nowMs();
+	std::vector<cv::Point> points;
+	collectEdgePoints(gray, points, result);
+	result.collectTime = nowMs() - start;
+
+	if (points.empty()) {
+		return result;
+	}
+	if (opts.houghLines) {
+		houghLines(points, gray.size(), result);
+	}
+	if (opts.houghCircles) {
+		houghCircles(points, gray.size(), result);
+	}
+	return result;
+}
+
+void houghStage(const VARIANT &variant, const cv::Mat &edges, std::ostream &file) {
+	if (!(opts.houghLines || opts.houghCircles) || edges.empty()) {
+		return;
+	}
+
+	file << "Starting Hough transform on " << variant.name << " edges.\n";
+	double start = runClock();
+	HOUGHRESULT result = houghTransform(edges);
+	double total = result.collectTime + result.voteTime + result.peakTime;
+	logStage(variant.name, "hough", start, total, result.edgePixels);
+
+	file << "Hough transform on " << variant.name << ": " << result.edgePixels << " edge pixels (" << result.edgeDensity * 100
+		<< "% density), " << result.sampledPixels << " voted. Collect " << result.collectTime << " ms, vote " << result.voteTime
+		<< " ms, peaks " << result.peakTime << " ms, total " << total << " ms.\n";
+	if (opts.houghLines) {
+		file << "Found " << result.lines.size() << " lines (rho, theta):";
+		for (size_t i = 0; i < result.lines.size(); ++i) {
+			file << " (" << result.lines[i][0] << ", " << result.lines[i][1] << ")";
+		}
+		file << "\n";
+	}
+	if (opts.houghCircles) {
+		file << "Found " << result.circles.size() << " circles (x, y, r):";
+		for (size_t i = 0; i < result.circles.size(); ++i) {
+			file << " (" << result.circles[i][0] << ", " << result.circles[i][1] << ", " << result.circles[i][2] << ")";
+		}
+		file << "\n";
+	}
+
+	std::lock_guard<std::mutex> guard(houghTotalsLock);
+	HOUGHTOTALS &totals = houghTotals[variant.name];
+	totals.runs++;
+	totals.density += result.edgeDensity;
+	totals.edgePixels += result.edgePixels;
+	totals.time += total;
+}
+
+void appendHoughReport(std::ostream &file) {
+	std::lock_guard<std::mutex> guard(houghTotalsLock);
+	if (houghTotals.empty()) {
+		return;
+	}
+
+	file << "Hough transform cost by detector (mean edge density, mean time, time per 1000 edge pixels):\n";
+	for (int v = 0; v < variantCount; ++v) {
+		std::map<std::string, HOUGHTOTALS>::const_iterator it = houghTotals.find(variants[v].name);
+		if (it == houghTotals.end()) {
+			continue;
+		}
+		const HOUGHTOTALS &totals = it->second;
+		file << "  " << variants[v].name << ": " << totals.density / totals.runs * 100 << "%, " << totals.time / totals.runs
+			<< " ms, " << (totals.edgePixels > 0 ? totals.time / totals.edgePixels * 1000 : 0) << " ms\n";
+	}
+}
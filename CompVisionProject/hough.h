@@ -0,0 +1,44 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <ostream>
+#include <vector>
+#include "main.h"
+
+/*
+	Output of one Hough transform run: the detected lines (rho, theta) and circles (x, y, radius), strongest first,
+	with the edge density of the input and where the time went.
+	- Pavel Shekhter
+*/
+struct HOUGHRESULT {
+	std::vector<cv::Vec2f> lines;
+	std::vector<cv::Vec3f> circles;
+	int edgePixels = 0;
+	int sampledPixels = 0;
+	double edgeDensity = 0;     // fraction of pixels that are edges
+	double collectTime = 0;     // ms spent gathering edge points
+	double voteTime = 0;        // ms spent voting, over all threads
+	double peakTime = 0;        // ms spent merging accumulators and picking peaks
+};
+
+/*
+	Runs the Hough line and/or circle transform (as selected by --hough) on an edge map. Any pixel above
+	--hough-edge-threshold counts as an edge. Votes go into one accumulator per thread using precomputed
+	sin/cos tables, and the accumulators are summed at the end. With --hough-sample=F only a fraction F of
+	the edge pixels vote and the vote thresholds are scaled to match.
+	- Pavel Shekhter
+*/
+HOUGHRESULT houghTransform(const cv::Mat &edges);
+
+/*
+	Runs the Hough stage on a variant's edge map, writes the result to the report and records its timing
+	against the edge density for appendHoughReport.
+	- Pavel Shekhter
+*/
+void houghStage(const VARIANT &variant, const cv::Mat &edges, std::ostream &file);
+
+/*
+	Appends, for each variant, the mean edge density and Hough time, and the time per thousand edge pixels.
+	- Pavel Shekhter
+*/
+void appendHoughReport(std::ostream &file);
@@ -13,73 +13,122 @@
 #include <opencv2/highgui.hpp>
 #include <string>
 #include <fstream>
+#include <sstream>
 #include <thread>
 #include <functional>
 #include <vector>
 #include <boost/filesystem.hpp>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
 #include "main.h"
-
-struct IMAGEDATA {
-	cv::Mat currentFrameColor;
-	cv::Mat currentFrameGry;
-	cv::Mat cannyGaussianDetectedEdges;
-	cv::Mat cannyNormalizedDetectedEdges;
-    cv::Mat cannyBoxDetectedEdges;
-	cv::Mat laplaceDest;
-	cv::Mat sobelGrad;
-	cv::Mat sobelXGrad;
-	cv::Mat sobelYGrad;
-	cv::Mat sobelAbsXGrad;
-	cv::Mat sobelAbsYGrad;
-	cv::Mat gaborDest;
-	std::vector<cv::Mat> gaborKernels;
-	cv::Mat gaborSrc_f;
-    cv::Mat imgForegroundCGD;
-    cv::Mat imgForegroundCND;
-    cv::Mat imgForegroundCBD;
-    cv::Mat imgForegroundLGD;
-    cv::Mat imgForegroundLND;
-    cv::Mat imgForegroundLBD;
-    cv::Mat imgForegroundSGD;
-    cv::Mat imgForegroundSND;
-    cv::Mat imgForegroundSBD;
-    cv::Mat imgForegroundGab;
-	int canny_lowThresh;
-	int canny_Ratio = 3;
-	int canny_Kernel = 3;
-	int laplace_kernel = 3;
-	int laplace_scale = 1;
-	int laplace_delta = 0;
-	int laplace_ddepth = CV_16S;
-	int sobel_scale = 1;
-	int sobel_delta = 0;
-	int sobel_ddepth = CV_16S;
-	int gaborKernelSize = 31;
-	double gaborSig = 4.0, gaborTh = 45.0, gaborLm = 10.0, gaborGm = 0.5, gaborPs = 0;
-} id;
+#include "service.h"
+#include "resultcache.h"
+#include "hough.h"
+#include "preview.h"
+#include "tiling.h"
+#include "perfcounters.h"
+#include "compare.h"
+#include "thinning.h"
+#include "atlas.h"
+#include "tuner.h"
+#include "runlog.h"
+#include "smoothing.h"
+#include "shard.h"
+
+IMAGEDATA id;
+RUNOPTIONS opts;
 
 
+/*
+	Picks the imread flag for the requested analysis scale. Scales of 2, 4 and 8 map onto the reduced
+	decodes, which JPEG performs in the DCT domain instead of decoding at full size and resizing.
+	- Pavel Shekhter
+*/
+ int decodeFlag(bool gray, int scale) {
+	 switch (scale) {
+		 case 2: return gray ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+		 case 4: return gray ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+		 case 8: return gray ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+		 default: return gray ? cv::IMREAD_GRAYSCALE : CV_LOAD_IMAGE_COLOR;
+	 }
+ }
 
 /*
-	Reads the video file into the frame buffer.
+	Decodes an image into the frame buffer using the given decoder, which is passed the imread flags to use.
+	With --gray the greyscale plane is decoded directly, and the colour plane is only decoded when
+	marked overlays are requested.
 	- Pavel Shekhter
 */
- IMAGEDATA readImageData(std::string imagefile) {
+ static IMAGEDATA decodeImageData(const std::function<cv::Mat(int)> &decode) {
 
-	 cv::Mat image = cv::imread(imagefile, CV_LOAD_IMAGE_COLOR);
+	 if (opts.grayDirect && !opts.markContours) {
+		 id.currentFrameColor.release();
+		 id.currentFrameGry = decode(decodeFlag(true, opts.analysisScale));
+		 return id;
+	 }
+
+	 cv::Mat image = decode(decodeFlag(false, opts.analysisScale));
 	 id.currentFrameColor = image;
 
+	 if (opts.grayDirect && image.data) {
+		 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_BGR2GRAY);
+	 }
+
 	return id;
 }
 
+/*
+	Reads the video file into the frame buffer.
+	- Pavel Shekhter
+*/
+ IMAGEDATA readImageData(std::string imagefile) {
+	 return decodeImageData([&imagefile](int flags) { return cv::imread(imagefile, flags); });
+ }
+
+/*
+	Reads an encoded image held in memory into the frame buffer.
+	- Pavel Shekhter
+*/
+ IMAGEDATA readImageBuffer(const std::vector<uchar> &buffer) {
+	 return decodeImageData([&buffer](int flags) { return cv::imdecode(buffer, flags); });
+ }
+
+/*
+	Returns true if the frame buffer holds a decoded image.
+	- Pavel Shekhter
+*/
+ bool frameLoaded(const IMAGEDATA &data) {
+	 return (opts.grayDirect && !opts.markContours) ? data.currentFrameGry.data != NULL : data.currentFrameColor.data != NULL;
+ }
+
+/*
+	Smooths the current frame with a size x size filter and refreshes the greyscale plane from it.
+	A frame decoded straight to greyscale has no colour plane, so the greyscale plane is smoothed in place.
+	- Pavel Shekhter
+*/
+ void smoothCurrentFrame(SMOOTHTYPE type, int size, double sigma) {
+	 if (type == SMOOTH_NONE) {
+		 return;
+	 }
+
+	 bool hasColor = !id.currentFrameColor.empty();
+	 cv::Mat &src = hasColor ? id.currentFrameColor : id.currentFrameGry;
+	 smoothImage(src, src, type, size, sigma);
+
+	 if (hasColor) {
+		 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_RGB2GRAY);
+	 }
+ }
+
  /*
 	Sets up the report.
 	- Pavel Shekhter
  */
  void setUpFile(std::ofstream &file, std::string &report_name, std::ofstream &csv) {
-	 file << "Edge Detection Analysis Data: " << std::endl;
-	 file << "Report file name: " << report_name << std::endl;
+	 file << "Edge Detection Analysis Data: \n";
+	 file << "Report file name: " << report_name << "\n";
 	 file << "\n\n";
 
 	 csv << "Trial #, Laplacian w/ Gaussian Blur, Laplacian w/ Normalized Box Filter, Laplacian w/ Box Filter, ";
@@ -107,9 +156,228 @@ struct IMAGEDATA {
 			 file << "Unable to output to image." << std::endl;
 			 break;
 		 }
+		 case -4: {
+			 file << "Unable to start the service." << std::endl;
+			 break;
+		 }
+		 case -5: {
+			 file << "Unable to start a worker." << std::endl;
+			 break;
+		 }
 	 }
  }
 
+/*
+	Strips the --options from the command line, leaving the image files in images (images[0] is the program name).
+	Returns false if an option is not recognised.
+	- Pavel Shekhter
+*/
+ bool parseOptions(int argc, char ** argv, std::vector<char *> &images) {
+	 images.push_back(argv[0]);
+	 for (int i = 1; i < argc; i++) {
+		 std::string arg(argv[i]);
+		 if (arg.compare(0, 2, "--") != 0) {
+			 images.push_back(argv[i]);
+		 }
+		 else if (arg == "--gray") {
+			 opts.grayDirect = true;
+			 opts.markContours = false;
+		 }
+		 else if (arg == "--marked") {
+			 opts.markContours = true;
+		 }
+		 else if (arg.compare(0, 8, "--serve=") == 0) {
+			 opts.servePath = arg.substr(8);
+		 }
+		 else if (arg.compare(0, 14, "--service-log=") == 0) {
+			 opts.serviceLog = arg.substr(14);
+		 }
+		 else if (arg == "--no-cache") {
+			 opts.useCache = false;
+		 }
+		 else if (arg.compare(0, 12, "--cache-dir=") == 0) {
+			 opts.cacheDir = arg.substr(12);
+		 }
+		 else if (arg.compare(0, 8, "--hough=") == 0) {
+			 std::string mode = arg.substr(8);
+			 opts.houghLines = mode == "lines" || mode == "both";
+			 opts.houghCircles = mode == "circles" || mode == "both";
+			 if (!opts.houghLines && !opts.houghCircles) {
+				 std::cout << "--hough must be lines, circles or both" << std::endl;
+				 return false;
+			 }
+		 }
+		 else if (arg.compare(0, 15, "--hough-sample=") == 0) {
+			 opts.houghSample = std::atof(arg.c_str() + 15);
+			 if (opts.houghSample <= 0 || opts.houghSample > 1) {
+				 std::cout << "--hough-sample must be in (0, 1]" << std::endl;
+				 return false;
+			 }
+		 }
+		 else if (arg.compare(0, 18, "--hough-threshold=") == 0) {
+			 opts.houghThreshold = std::atoi(arg.c_str() + 18);
+		 }
+		 else if (arg.compare(0, 23, "--hough-edge-threshold=") == 0) {
+			 opts.houghEdgeThreshold = std::atoi(arg.c_str() + 23);
+		 }
+		 else if (arg.compare(0, 15, "--hough-radius=") == 0) {
+			 if (sscanf(arg.c_str() + 15, "%d:%d:%d", &opts.houghMinRadius, &opts.houghMaxRadius, &opts.houghRadiusStep) < 2) {
+				 std::cout << "--hough-radius must be min:max or min:max:step" << std::endl;
+				 return false;
+			 }
+		 }
+		 else if (arg.compare(0, 21, "--hough-circle-ratio=") == 0) {
+			 opts.houghCircleRatio = std::atof(arg.c_str() + 21);
+		 }
+		 else if (arg.compare(0, 14, "--hough-limit=") == 0) {
+			 opts.houghMaxResults = std::atoi(arg.c_str() + 14);
+		 }
+		 else if (arg == "--no-preview") {
+			 opts.preview = false;
+		 }
+		 else if (arg.compare(0, 15, "--preview-size=") == 0) {
+			 opts.previewSize = std::max(16, std::atoi(arg.c_str() + 15));
+		 }
+		 else if (arg.compare(0, 11, "--variants=") == 0) {
+			 opts.variantList = arg.substr(11);
+		 }
+		 else if (arg.compare(0, 14, "--tile-budget=") == 0) {
+			 opts.tileBudgetMB = std::atof(arg.c_str() + 14);
+		 }
+		 else if (arg.compare(0, 15, "--tile-overlap=") == 0) {
+			 opts.tileOverlap = std::atoi(arg.c_str() + 15);
+		 }
+		 else if (arg.compare(0, 16, "--perf-counters=") == 0) {
+			 opts.perfCounterFile = arg.substr(16);
+		 }
+		 else if (arg.compare(0, 7, "--thin=") == 0) {
+			 std::string mode = arg.substr(7);
+			 if (mode == "otsu") opts.thinMode = THIN_OTSU;
+			 else if (mode == "adaptive") opts.thinMode = THIN_ADAPTIVE;
+			 else {
+				 std::cout << "--thin must be otsu or adaptive" << std::endl;
+				 return false;
+			 }
+		 }
+		 else if (arg.compare(0, 13, "--thin-block=") == 0) {
+			 opts.thinBlock = std::max(3, std::atoi(arg.c_str() + 13) | 1);
+		 }
+		 else if (arg.compare(0, 14, "--thin-offset=") == 0) {
+			 opts.thinOffset = std::atof(arg.c_str() + 14);
+		 }
+		 else if (arg.compare(0, 8, "--batch=") == 0) {
+			 opts.batchSize = std::atoi(arg.c_str() + 8);
+		 }
+		 else if (arg.compare(0, 14, "--atlas-width=") == 0) {
+			 opts.atlasWidth = std::max(64, std::atoi(arg.c_str() + 14));
+		 }
+		 else if (arg.compare(0, 7, "--tune=") == 0) {
+			 opts.tuneProfile = arg.substr(7);
+		 }
+		 else if (arg.compare(0, 14, "--tune-budget=") == 0) {
+			 opts.tuneBudget = std::atof(arg.c_str() + 14);
+		 }
+		 else if (arg.compare(0, 15, "--tune-quality=") == 0) {
+			 opts.tuneQuality = std::atof(arg.c_str() + 15);
+		 }
+		 else if (arg.compare(0, 10, "--profile=") == 0) {
+			 opts.profileFile = arg.substr(10);
+		 }
+		 else if (arg.compare(0, 10, "--run-log=") == 0) {
+			 opts.runLogFile = arg.substr(10);
+		 }
+		 else if (arg.compare(0, 7, "--blur=") == 0) {
+			 size_t colon = arg.find(':');
+			 std::string family = arg.substr(7, colon == std::string::npos ? std::string::npos : colon - 7);
+			 int size = 0;
+			 double sigma = 0;
+			 if (colon == std::string::npos || sscanf(arg.c_str() + colon, ":%d:%lf", &size, &sigma) < 1 || size < 1 ||
+				 (family != "canny" && family != "laplace" && family != "sobel" && family != "all")) {
+				 std::cout << "--blur must be canny|laplace|sobel|all:size[:sigma]" << std::endl;
+				 return false;
+			 }
+			 std::string sizeText = std::to_string(size), sigmaText = std::to_string(sigma);
+			 const char *families[] = { "canny", "laplace", "sobel" };
+			 for (int f = 0; f < 3; ++f) {
+				 if (family == "all" || family == families[f]) {
+					 setParameter(id, std::string(families[f]) + "_blurSize", sizeText);
+					 setParameter(id, std::string(families[f]) + "_blurSigma", sigmaText);
+				 }
+			 }
+		 }
+		 else if (arg.compare(0, 16, "--smooth-engine=") == 0) {
+			 std::string engine = arg.substr(16);
+			 if (engine == "auto") opts.smoothEngine = ENGINE_AUTO;
+			 else if (engine == "opencv") opts.smoothEngine = ENGINE_OPENCV;
+			 else if (engine == "constant") opts.smoothEngine = ENGINE_CONSTANT;
+			 else {
+				 std::cout << "--smooth-engine must be auto, opencv or constant" << std::endl;
+				 return false;
+			 }
+		 }
+		 else if (arg.compare(0, 21, "--constant-time-from=") == 0) {
+			 opts.constantTimeFrom = std::max(1, std::atoi(arg.c_str() + 21));
+		 }
+		 else if (arg.compare(0, 10, "--workers=") == 0) {
+			 opts.workers = std::max(0, std::atoi(arg.c_str() + 10));
+		 }
+		 else if (arg == "--pin") {
+			 opts.pinWorkers = true;
+		 }
+		 else if (arg.compare(0, 12, "--shard-dir=") == 0) {
+			 opts.shardDir = arg.substr(12);
+		 }
+		 else if (arg.compare(0, 18, "--shard-transport=") == 0) {
+			 std::string transport = arg.substr(18);
+			 if (transport == "shm") opts.shardTransport = SHARD_SHM;
+			 else if (transport == "file") opts.shardTransport = SHARD_FILE;
+			 else {
+				 std::cout << "--shard-transport must be shm or file" << std::endl;
+				 return false;
+			 }
+		 }
+		 else if (arg.compare(0, 15, "--shard-launch=") == 0) {
+			 std::string launch = arg.substr(15);
+			 if (launch == "local") opts.launchWorkers = true;
+			 else if (launch == "none") opts.launchWorkers = false;
+			 else {
+				 std::cout << "--shard-launch must be local or none" << std::endl;
+				 return false;
+			 }
+		 }
+		 else if (arg.compare(0, 16, "--shard-timeout=") == 0) {
+			 opts.shardTimeout = std::atof(arg.c_str() + 16);
+		 }
+		 else if (arg.compare(0, 9, "--worker=") == 0) {
+			 opts.workerShard = arg.substr(9);
+		 }
+		 else if (arg.compare(0, 10, "--compare=") == 0) {
+			 opts.compareFile = arg.substr(10);
+		 }
+		 else if (arg.compare(0, 11, "--baseline=") == 0) {
+			 opts.baselineFile = arg.substr(11);
+		 }
+		 else if (arg.compare(0, 8, "--alpha=") == 0) {
+			 opts.compareAlpha = std::atof(arg.c_str() + 8);
+		 }
+		 else if (arg.compare(0, 9, "--effect=") == 0) {
+			 opts.compareEffect = std::atof(arg.c_str() + 9);
+		 }
+		 else if (arg.compare(0, 8, "--scale=") == 0) {
+			 opts.analysisScale = std::atoi(arg.c_str() + 8);
+			 if (opts.analysisScale != 1 && opts.analysisScale != 2 && opts.analysisScale != 4 && opts.analysisScale != 8) {
+				 std::cout << "--scale must be 1, 2, 4 or 8" << std::endl;
+				 return false;
+			 }
+		 }
+		 else {
+			 std::cout << "Unknown option: " << arg << std::endl;
+			 return false;
+		 }
+	 }
+	 return true;
+ }
+
 /*
 	Parses the arguments from the command line.
 	- Pavel Shekhter
@@ -122,14 +390,14 @@ struct IMAGEDATA {
 	 if (!imagefile.empty()) {
 		 IMAGEDATA id = readImageData(imagefile);
 
-		 if (!id.currentFrameColor.data) {
+		 if (!frameLoaded(id)) {
 			 std::cout << "Can't open file!" << std::endl;
 			 appendErrorMessage(file, -1);
 			 return -1;
 		 }
 	 }
 
-	 file << "Processing File: " << argv << std::endl;
+	 file << "Processing File: " << argv << "\n";
 
 	 retflag = false;
 	 return {};
@@ -139,11 +407,33 @@ struct IMAGEDATA {
  Finds the contour lines and outputs them into a matrix.
  - Pavel Shekhter
  */
- void findContours (cv::Mat& mat, cv::Mat& bgkMat, cv::Mat& edges, cv::Mat& sumMat, std::ofstream& file) {
-     file << "Finding and marking contours..." << std::endl;
+ void findContours (cv::Mat& mat, cv::Mat& bgkMat, cv::Mat& edges, cv::Mat& sumMat) {
      std::vector<cv::Vec4i> hierarchy;
      std::vector<std::vector<cv::Point>> contours;
+     PERFSCOPE perf;
+     double start = runClock ();
+     perfBegin (perf, "", "contours", (double)mat.total ());
      cv::findContours (mat, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_SIMPLE, cv::Point (0, 0));
+
+     // In tiled mode only the contours that start in the tile's core are counted. A contour that crosses a core
+     // boundary is traced separately in each tile it reaches and may be counted by more than one of them
+     id.contourCount = 0;
+     id.contourPoints = 0;
+     for (size_t i = 0; i < contours.size (); i++) {
+         if (id.contourRegion.area () > 0 && !id.contourRegion.contains (contours[i][0])) {
+             continue;
+         }
+         id.contourCount++;
+         id.contourPoints += contours[i].size ();
+     }
+
+     // Without a colour plane there is nothing to mark the contours onto
+     if (bgkMat.empty ()) {
+         perfEnd (perf);
+         logStage ("", "contours", start, runClock () - start, id.contourCount);
+         return;
+     }
+
      cv::Mat drawing = cv::Mat::zeros (edges.size (), CV_8UC3);
      for (int i = 0; i < contours.size (); i++) {
          cv::RNG rng (12345);
@@ -151,21 +441,20 @@ struct IMAGEDATA {
          cv::drawContours (drawing, contours, i, color, 2, 8, hierarchy, 0, cv::Point ());
      }
      cv::addWeighted (bgkMat, 1.0, drawing, 0.5, 0.0, sumMat);
+     perfEnd (perf);
+     logStage ("", "contours", start, runClock () - start, id.contourCount);
  }
 
  /*
 	Performs a Canny edge detector using Gaussian blur.
 	- Pavel Shekhter
  */
- void gaussianCanny(std::ofstream &file, char * argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Canny w/Gaussian Blur. Initial Time: ";
-
+ void gaussianCanny(char * argv, cv::Mat &mat, cv::Mat & colorMat) {
      // Get initial time
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
 
      // Convolve the greyscale image with a 3x3 Gaussian Blur matrix and output to a detected-edges matrix
-	 cv::GaussianBlur(id.currentFrameGry, id.cannyGaussianDetectedEdges, cv::Size(3, 3), 0, 0, cv::BORDER_DEFAULT);
+	 smoothImage(id.currentFrameGry, id.cannyGaussianDetectedEdges, SMOOTH_GAUSSIAN, id.canny_blurSize, id.canny_blurSigma);
 
      // Use the Canny edge detector with the defined low threshold, ratio, and kernel
 	 cv::Canny(id.cannyGaussianDetectedEdges, id.cannyGaussianDetectedEdges, id.canny_lowThresh, id.canny_lowThresh * id.canny_Ratio, id.canny_Kernel);
@@ -176,17 +465,14 @@ struct IMAGEDATA {
 	 id.currentFrameGry.copyTo(dst, id.cannyGaussianDetectedEdges);
 
      // Calculate final time
-	 file << "Canny w/Gaussian Blur finished. Final Time: ";
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Canny w/Gaussian Blur took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 
      // Output the destination matrix (mat is a cv::Mat located outside the function in a struct)
 	 mat = dst;
 
      // Find the contours
-     findContours (dst, colorMat, id.cannyGaussianDetectedEdges, colorMat, file);
+     findContours (dst, colorMat, id.cannyGaussianDetectedEdges, colorMat);
      
 }
 
@@ -194,29 +480,23 @@ struct IMAGEDATA {
  Performs a Canny edge detector using normalized box blur.
  - Pavel Shekhter
  */
- void normalizedCanny(std::ofstream &file, char * argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Canny w/Normalized Box Blur. Initial Time: ";
-
+ void normalizedCanny(char * argv, cv::Mat &mat, cv::Mat & colorMat) {
      // Get initial time
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
 
      // Convolve the greyscale image with a 3x3 Normalized Box Blur matrix and output to a detected-edges matrix
-	 cv::blur(id.currentFrameGry, id.cannyNormalizedDetectedEdges, cv::Size(3, 3));
+	 smoothImage(id.currentFrameGry, id.cannyNormalizedDetectedEdges, SMOOTH_NORMALIZED_BOX, id.canny_blurSize, id.canny_blurSigma);
 
      // Use the Canny edge detector with the defined low threshold, ratio, and kernel
 	 cv::Canny(id.cannyNormalizedDetectedEdges, id.cannyNormalizedDetectedEdges, id.canny_lowThresh, id.canny_lowThresh * id.canny_Ratio, id.canny_Kernel);
 	 cv::Mat dst;
 	 dst = cv::Scalar::all(0);
 	 id.currentFrameGry.copyTo(dst, id.cannyNormalizedDetectedEdges);
-	 file << "Canny w/Normalized Box Blur finished. Final Time: ";
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Canny w/Normalized Box Blur took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 	 mat = dst;
 
-     findContours (dst, colorMat, id.cannyNormalizedDetectedEdges, colorMat, file);
+     findContours (dst, colorMat, id.cannyNormalizedDetectedEdges, colorMat);
 
  }
 
@@ -224,23 +504,18 @@ struct IMAGEDATA {
  Performs a Canny edge detector using box filter.
  - Pavel Shekhter
  */
- void boxCanny(std::ofstream &file, char * argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Canny w/Box Filter. Initial Time: ";
+ void boxCanny(char * argv, cv::Mat &mat, cv::Mat & colorMat) {
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 cv::boxFilter(id.currentFrameGry, id.cannyBoxDetectedEdges, -1, cv::Size(3, 3), cv::Point(-1, -1), true, cv::BORDER_DEFAULT);
+	 smoothImage(id.currentFrameGry, id.cannyBoxDetectedEdges, SMOOTH_BOX, id.canny_blurSize, id.canny_blurSigma);
 	 cv::Canny(id.cannyBoxDetectedEdges, id.cannyBoxDetectedEdges, id.canny_lowThresh, id.canny_lowThresh * id.canny_Ratio, id.canny_Kernel);
 	 cv::Mat dst;
 	 dst = cv::Scalar::all(0);
 	 id.currentFrameGry.copyTo(dst, id.cannyBoxDetectedEdges);
-	 file << "Canny w/Box Filter finished. Final Time: ";
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Canny w/Box Filter took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 	 mat = dst;
 
-     findContours (dst, colorMat, id.cannyBoxDetectedEdges, colorMat, file);
+     findContours (dst, colorMat, id.cannyBoxDetectedEdges, colorMat);
 
  }
 
@@ -248,24 +523,21 @@ struct IMAGEDATA {
 Performs a Laplacian edge detector using Gausian filter.
 - Pavel Shekhter
  */
- void gausianLaplace(std::ofstream &file, char * argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Laplacian w/ Gaussian Blur. Initial time: ";
+ void gausianLaplace(char * argv, cv::Mat &mat, cv::Mat & colorMat) {
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 cv::GaussianBlur(id.currentFrameColor, id.currentFrameColor, cv::Size(3, 3), 0, 0, cv::BORDER_DEFAULT);
-	 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_RGB2GRAY);
+	 smoothCurrentFrame(SMOOTH_GAUSSIAN, id.laplace_blurSize, id.laplace_blurSigma);
 	 cv::Mat abs_dst;
 	 cv::Laplacian(id.currentFrameGry, mat, id.laplace_ddepth, id.laplace_kernel, id.laplace_scale, id.laplace_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(mat, abs_dst);
+	 if (opts.thinMode != THIN_NONE) {
+		 thinZeroCrossings(mat, abs_dst);
+	 }
 	 mat = abs_dst;
 	 id.laplaceDest = abs_dst;
-	 file << "Laplacian w/ Gaussian Blur finished. Final Time: ";
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Laplacian w/ Gaussian Blur took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 
-     findContours (abs_dst, colorMat, id.laplaceDest, colorMat, file);
+     findContours (abs_dst, colorMat, id.laplaceDest, colorMat);
 	 
  }
 
@@ -273,24 +545,21 @@ Performs a Laplacian edge detector using Gausian filter.
  Performs a Laplacian edge detector using normalized box blur.
  - Pavel Shekhter
  */
- void normalizedLaplace(std::ofstream &file, char * argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Laplacian w/ Normalized Box Blur. Initial time: ";
+ void normalizedLaplace(char * argv, cv::Mat &mat, cv::Mat & colorMat) {
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 cv::blur(id.currentFrameColor, id.currentFrameColor, cv::Size(3, 3));
-	 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_RGB2GRAY);
+	 smoothCurrentFrame(SMOOTH_NORMALIZED_BOX, id.laplace_blurSize, id.laplace_blurSigma);
 	 cv::Mat abs_dst;
 	 cv::Laplacian(id.currentFrameGry, mat, id.laplace_ddepth, id.laplace_kernel, id.laplace_scale, id.laplace_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(mat, abs_dst);
+	 if (opts.thinMode != THIN_NONE) {
+		 thinZeroCrossings(mat, abs_dst);
+	 }
 	 mat = abs_dst;
 	 id.laplaceDest = abs_dst;
-	 file << "Laplacian w/ Normalized Box Blur finished. Final Time: ";
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Laplacian w/ Normalized Box Blur took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 
-     findContours (abs_dst, colorMat, id.laplaceDest, colorMat, file);
+     findContours (abs_dst, colorMat, id.laplaceDest, colorMat);
 
  }
 
@@ -298,135 +567,138 @@ Performs a Laplacian edge detector using Gausian filter.
  Performs a Laplacian edge detector using box filter.
  - Pavel Shekhter
  */
- void boxLaplace(std::ofstream &file, char * argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Laplacian w/ Box filter. Initial time: ";
+ void boxLaplace(char * argv, cv::Mat &mat, cv::Mat & colorMat) {
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 cv::boxFilter(id.currentFrameColor, id.currentFrameColor, -1, cv::Size(3, 3), cv::Point(-1, -1), true, cv::BORDER_DEFAULT);
-	 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_RGB2GRAY);
+	 smoothCurrentFrame(SMOOTH_BOX, id.laplace_blurSize, id.laplace_blurSigma);
 	 cv::Mat abs_dst;
 	 cv::Laplacian(id.currentFrameGry, mat, id.laplace_ddepth, id.laplace_kernel, id.laplace_scale, id.laplace_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(mat, abs_dst);
+	 if (opts.thinMode != THIN_NONE) {
+		 thinZeroCrossings(mat, abs_dst);
+	 }
 	 mat = abs_dst;
 	 id.laplaceDest = abs_dst;
-	 file << "Laplacian w/ Box Filter finished. Final Time: ";
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Laplacian w/ Box Filter Blur took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 
-     findContours (abs_dst, colorMat, id.laplaceDest, colorMat, file);
+     findContours (abs_dst, colorMat, id.laplaceDest, colorMat);
 
  }
 
  /*
 Perform Sobel edge detection using Gaussian blur
  */
- void gaussianSobel(std::ofstream &file, char *argv, cv::Mat &mat, std::ofstream &csv, cv::Mat& colorMat) {
-	 file << "Starting Sobel w/ Gaussian Blur. Initial time: ";
+ void gaussianSobel(char *argv, cv::Mat &mat, cv::Mat & colorMat) {
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 cv::GaussianBlur(id.currentFrameColor, id.currentFrameColor, cv::Size(3, 3), 0, 0, cv::BORDER_DEFAULT);
-	 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_RGB2GRAY);
+	 smoothCurrentFrame(SMOOTH_GAUSSIAN, id.sobel_blurSize, id.sobel_blurSigma);
 
 	 // Perform Sobel on X-Gradient
 	 cv::Sobel(id.currentFrameGry, id.sobelXGrad, id.sobel_ddepth, 1, 0, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(id.sobelXGrad, id.sobelAbsXGrad);
 
 	 // Perform Sobel on Y-Gradient
-	 cv::Sobel(id.currentFrameGry, id.sobelYGrad, id.sobel_ddepth, 1, 0, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
+	 cv::Sobel(id.currentFrameGry, id.sobelYGrad, id.sobel_ddepth, 0, 1, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(id.sobelYGrad, id.sobelAbsYGrad);
 
 	 // Add Gradients
 	 cv::addWeighted(id.sobelAbsXGrad, 0.5, id.sobelAbsYGrad, 0.5, 0, id.sobelGrad);
-	 file << "Sobel w/ Gaussian Blur finished. Final Time: ";
+	 if (opts.thinMode != THIN_NONE) {
+		 thinGradient(id.sobelXGrad, id.sobelYGrad, id.sobelGrad);
+	 }
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Sobel w/ Gaussian Blur took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 	 mat = id.sobelGrad;
 
-     findContours (mat, colorMat, id.sobelGrad, colorMat, file);
+     findContours (mat, colorMat, id.sobelGrad, colorMat);
 
  }
 
  /*
  Perform Sobel edge detection using Normalized Box Filter
  */
- void normalizedSobel(std::ofstream &file, char *argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Sobel w/ Normalized Box Filter. Initial time: ";
+ void normalizedSobel(char *argv, cv::Mat &mat, cv::Mat & colorMat) {
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 cv::blur(id.currentFrameColor, id.currentFrameColor, cv::Size(3, 3));
-	 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_RGB2GRAY);
+	 smoothCurrentFrame(SMOOTH_NORMALIZED_BOX, id.sobel_blurSize, id.sobel_blurSigma);
 
 	 // Perform Sobel on X-Gradient
 	 cv::Sobel(id.currentFrameGry, id.sobelXGrad, id.sobel_ddepth, 1, 0, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(id.sobelXGrad, id.sobelAbsXGrad);
 
 	 // Perform Sobel on Y-Gradient
-	 cv::Sobel(id.currentFrameGry, id.sobelYGrad, id.sobel_ddepth, 1, 0, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
+	 cv::Sobel(id.currentFrameGry, id.sobelYGrad, id.sobel_ddepth, 0, 1, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(id.sobelYGrad, id.sobelAbsYGrad);
 
 	 // Add Gradients
 	 cv::addWeighted(id.sobelAbsXGrad, 0.5, id.sobelAbsYGrad, 0.5, 0, id.sobelGrad);
-	 file << "Sobel w/ Normalized Box Filter finished. Final Time: ";
+	 if (opts.thinMode != THIN_NONE) {
+		 thinGradient(id.sobelXGrad, id.sobelYGrad, id.sobelGrad);
+	 }
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Sobel w/ Normalized Box Filter took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 	 mat = id.sobelGrad;
 
-     findContours (mat, colorMat, id.sobelGrad, colorMat, file);
+     findContours (mat, colorMat, id.sobelGrad, colorMat);
 
  }
 
  /*
  Perform Sobel edge detection using Normalized Box Filter
  */
- void boxSobel(std::ofstream &file, char *argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Sobel w/ Box Filter. Initial time: ";
+ void boxSobel(char *argv, cv::Mat &mat, cv::Mat & colorMat) {
 	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 cv::boxFilter(id.currentFrameColor, id.currentFrameColor, -1, cv::Size(3, 3), cv::Point(-1, -1), true, cv::BORDER_DEFAULT);
-	 cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_RGB2GRAY);
+	 smoothCurrentFrame(SMOOTH_BOX, id.sobel_blurSize, id.sobel_blurSigma);
 
 	 // Perform Sobel on X-Gradient
 	 cv::Sobel(id.currentFrameGry, id.sobelXGrad, id.sobel_ddepth, 1, 0, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(id.sobelXGrad, id.sobelAbsXGrad);
 
 	 // Perform Sobel on Y-Gradient
-	 cv::Sobel(id.currentFrameGry, id.sobelYGrad, id.sobel_ddepth, 1, 0, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
+	 cv::Sobel(id.currentFrameGry, id.sobelYGrad, id.sobel_ddepth, 0, 1, 3, id.sobel_scale, id.sobel_delta, cv::BORDER_DEFAULT);
 	 cv::convertScaleAbs(id.sobelYGrad, id.sobelAbsYGrad);
 
 	 // Add Gradients
 	 cv::addWeighted(id.sobelAbsXGrad, 0.5, id.sobelAbsYGrad, 0.5, 0, id.sobelGrad);
-	 file << "Sobel w/ Box Filter finished. Final Time: ";
+	 if (opts.thinMode != THIN_NONE) {
+		 thinGradient(id.sobelXGrad, id.sobelYGrad, id.sobelGrad);
+	 }
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Sobel w/ Box Filter took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 	 mat = id.sobelGrad;
 
-     findContours (mat, colorMat, id.sobelGrad, colorMat, file);
+     findContours (mat, colorMat, id.sobelGrad, colorMat);
 
  }
 
  /*
- Perform a Gabor filter-based edge detector with no additional filtering
+ Creates the Gabor kernels. They are kept between calls and only rebuilt when the Gabor parameters change.
+ - Pavel Shekhter
  */
- void gabor(std::ofstream &file, char *argv, cv::Mat &mat, std::ofstream &csv, cv::Mat & colorMat) {
-	 file << "Starting Gabor filter-based edge detector w/ no additional filtering. Initial time: ";
-	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << initGCTime * 1000 << " ms" << std::endl;
-	 mat = id.currentFrameGry;
+ void buildGaborKernels() {
+	 static double builtWith[6];
+	 double current[6] = { (double)id.gaborKernelSize, id.gaborSig, id.gaborTh, id.gaborLm, id.gaborGm, id.gaborPs };
 
-	 // Create a vector of kernels and filter
+	 if (!id.gaborKernels.empty() && std::equal(current, current + 6, builtWith)) {
+		 return;
+	 }
+
+	 id.gaborKernels.clear();
 	 for (int i = 0; i < (M_PI / 16); i += (M_PI / 2)) {
 		 cv::Mat kern;
 		 kern = cv::getGaborKernel(cv::Size(id.gaborKernelSize, id.gaborKernelSize), id.gaborSig, id.gaborTh, id.gaborLm, id.gaborGm, id.gaborPs, CV_32F);
 		 id.gaborKernels.push_back(kern);
 	 }
+	 std::copy(current, current + 6, builtWith);
+ }
+
+/*
+ Perform a Gabor filter-based edge detector with no additional filtering
+ */
+ void gabor(char *argv, cv::Mat &mat, cv::Mat & colorMat) {
+	 double initGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
+	 mat = id.currentFrameGry;
+
+	 // Create a vector of kernels and filter
+	 buildGaborKernels();
 
 	 id.gaborDest = mat;
 
@@ -440,22 +712,223 @@ Perform Sobel edge detection using Gaussian blur
 
 		 id.gaborDest.convertTo(id.gaborDest, CV_8U, 1, 0); // Shift into proper 1..255 display range
 	 }
+	 if (opts.thinMode != THIN_NONE) {
+		 thinRidges(id.gaborDest);
+	 }
 
-	 file << "Gabor filter-based edge detector w/ no additional filtering completed. Final Time: ";
 	 double finalGCTime = (cv::getTickCount()) / (cv::getTickFrequency());
-	 file << finalGCTime * 1000 << " ms" << std::endl;
-	 file << "Gabor filter-based edge detector w/ no additional filtering took " << ((finalGCTime - initGCTime) * 1000) << " ms to complete." << std::endl;
-	 csv << (finalGCTime - initGCTime) * 1000 << ", ";
+	 id.lastDetectTime = (finalGCTime - initGCTime) * 1000;
 
-	 std::cerr << id.gaborDest(cv::Rect(30, 30, 10, 10)) << std::endl; // Peek into data
-	 std::cerr << mat(cv::Rect(30, 30, 10, 10)) << std::endl; // Peek into data
 	 mat = id.gaborDest;
 
-     findContours (mat, colorMat, id.gaborDest, colorMat, file);
+     findContours (mat, colorMat, id.gaborDest, colorMat);
+
+ }
+
+ /*
+ The edge detector variants, in CSV column order.
+ - Pavel Shekhter
+ */
+ const VARIANT variants[] = {
+	 { "laplace_gaussian", &gausianLaplace, SMOOTH_GAUSSIAN, "laplace_gaussian" },
+	 { "laplace_normalized", &normalizedLaplace, SMOOTH_NORMALIZED_BOX, "laplace_normalized" },
+	 { "laplace_box", &boxLaplace, SMOOTH_BOX, "laplace_box" },
+	 { "canny_gaussian", &gaussianCanny, SMOOTH_NONE, "canny_gaussian" },
+	 { "canny_normalized", &normalizedCanny, SMOOTH_NONE, "canny_normalized_box" },
+	 { "canny_box", &boxCanny, SMOOTH_NONE, "canny_box" },
+	 { "sobel_gaussian", &gaussianSobel, SMOOTH_GAUSSIAN, "sobel_gaussian" },
+	 { "sobel_normalized", &normalizedSobel, SMOOTH_NORMALIZED_BOX, "sobel_normalized" },
+	 { "sobel_box", &boxSobel, SMOOTH_BOX, "sobel_box" },
+	 { "gabor", &gabor, SMOOTH_NONE, "gabor" }
+ };
+ const int variantCount = sizeof(variants) / sizeof(variants[0]);
+
+ /*
+ Looks up a variant by name. Returns NULL if there is no such variant.
+ - Pavel Shekhter
+ */
+ const VARIANT *findVariant(const std::string &name) {
+	 for (int v = 0; v < variantCount; ++v) {
+		 if (name == variants[v].name) {
+			 return &variants[v];
+		 }
+	 }
+	 return NULL;
+ }
 
+ /*
+ The smoothing a variant applies, including the blur the Canny variants apply to their own copy of the frame,
+ with the aperture and sigma of its detector family.
+ - Pavel Shekhter
+ */
+ SMOOTHTYPE variantSmoothing(const VARIANT &variant, int &size, double &sigma) {
+	 if (variant.detect == &gaussianCanny || variant.detect == &normalizedCanny || variant.detect == &boxCanny) {
+		 size = id.canny_blurSize;
+		 sigma = id.canny_blurSigma;
+		 return variant.detect == &gaussianCanny ? SMOOTH_GAUSSIAN : variant.detect == &normalizedCanny ? SMOOTH_NORMALIZED_BOX : SMOOTH_BOX;
+	 }
+	 bool sobel = variant.detect == &gaussianSobel || variant.detect == &normalizedSobel || variant.detect == &boxSobel;
+	 size = sobel ? id.sobel_blurSize : id.laplace_blurSize;
+	 sigma = sobel ? id.sobel_blurSigma : id.laplace_blurSigma;
+	 return variant.smooth;
  }
 
  /*
+ Parses a comma-separated list of variant names into chosen. An empty list or "all" chooses every variant.
+ Returns false if a name is not a variant.
+ - Pavel Shekhter
+ */
+ bool parseVariantList(const std::string &list, std::vector<const VARIANT *> &chosen) {
+	 chosen.clear();
+	 if (list.empty() || list == "all") {
+		 for (int v = 0; v < variantCount; ++v) {
+			 chosen.push_back(&variants[v]);
+		 }
+		 return true;
+	 }
+
+	 std::istringstream names(list);
+	 std::string name;
+	 while (std::getline(names, name, ',')) {
+		 const VARIANT *v = findVariant(name);
+		 if (v == NULL) {
+			 std::cout << "Unknown variant: " << name << std::endl;
+			 return false;
+		 }
+		 chosen.push_back(v);
+	 }
+	 return !chosen.empty();
+ }
+
+ /*
+ Sets one detector parameter by name. Returns false if the name is not a parameter.
+ - Pavel Shekhter
+ */
+ bool setParameter(IMAGEDATA &data, const std::string &key, const std::string &value) {
+	 double v = std::atof(value.c_str());
+	 if (key == "canny_lowThresh") data.canny_lowThresh = (int)v;
+	 else if (key == "canny_Ratio") data.canny_Ratio = (int)v;
+	 else if (key == "canny_Kernel") data.canny_Kernel = (int)v;
+	 else if (key == "laplace_kernel") data.laplace_kernel = (int)v;
+	 else if (key == "laplace_scale") data.laplace_scale = (int)v;
+	 else if (key == "laplace_delta") data.laplace_delta = (int)v;
+	 else if (key == "sobel_scale") data.sobel_scale = (int)v;
+	 else if (key == "sobel_delta") data.sobel_delta = (int)v;
+	 else if (key == "gaborKernelSize") data.gaborKernelSize = (int)v;
+	 else if (key == "gaborSig") data.gaborSig = v;
+	 else if (key == "gaborTh") data.gaborTh = v;
+	 else if (key == "gaborLm") data.gaborLm = v;
+	 else if (key == "gaborGm") data.gaborGm = v;
+	 else if (key == "gaborPs") data.gaborPs = v;
+	 else if (key == "canny_blurSize") data.canny_blurSize = std::max(1, (int)v | 1);
+	 else if (key == "canny_blurSigma") data.canny_blurSigma = v;
+	 else if (key == "laplace_blurSize") data.laplace_blurSize = std::max(1, (int)v | 1);
+	 else if (key == "laplace_blurSigma") data.laplace_blurSigma = v;
+	 else if (key == "sobel_blurSize") data.sobel_blurSize = std::max(1, (int)v | 1);
+	 else if (key == "sobel_blurSigma") data.sobel_blurSigma = v;
+	 else return false;
+	 return true;
+ }
+
+ /*
+ Copies the detector parameters (but not the image buffers) from one IMAGEDATA to another.
+ - Pavel Shekhter
+ */
+ void copyParameters(const IMAGEDATA &from, IMAGEDATA &to) {
+	 to.canny_lowThresh = from.canny_lowThresh;
+	 to.canny_Ratio = from.canny_Ratio;
+	 to.canny_Kernel = from.canny_Kernel;
+	 to.laplace_kernel = from.laplace_kernel;
+	 to.laplace_scale = from.laplace_scale;
+	 to.laplace_delta = from.laplace_delta;
+	 to.laplace_ddepth = from.laplace_ddepth;
+	 to.sobel_scale = from.sobel_scale;
+	 to.sobel_delta = from.sobel_delta;
+	 to.sobel_ddepth = from.sobel_ddepth;
+	 to.gaborKernelSize = from.gaborKernelSize;
+	 to.gaborSig = from.gaborSig;
+	 to.gaborTh = from.gaborTh;
+	 to.gaborLm = from.gaborLm;
+	 to.gaborGm = from.gaborGm;
+	 to.gaborPs = from.gaborPs;
+	 to.canny_blurSize = from.canny_blurSize;
+	 to.canny_blurSigma = from.canny_blurSigma;
+	 to.laplace_blurSize = from.laplace_blurSize;
+	 to.laplace_blurSigma = from.laplace_blurSigma;
+	 to.sobel_blurSize = from.sobel_blurSize;
+	 to.sobel_blurSigma = from.sobel_blurSigma;
+ }
+
+/*
+ Runs one variant through the result cache. On a hit the cached edge map, marked overlay and contour statistics are
+ used and the detector is skipped; the variant's in-place smoothing is still applied so the variants after it see
+ the same frame they would have without the cache. Returns true on a hit.
+ - Pavel Shekhter
+ */
+ static bool detectCached(const VARIANT *variant, char * argv, cv::Mat &mat, cv::Mat &colorMat) {
+	 if (!opts.useCache) {
+		 variant->detect(argv, mat, colorMat);
+		 return false;
+	 }
+
+	 std::string key = resultCacheKey(*variant, id);
+	 cv::Mat marked;
+	 RESULTSTATS stats;
+	 double start = runClock();
+	 if (resultCacheLookup(key, mat, marked, stats)) {
+		 int size;
+		 double sigma;
+		 variantSmoothing(*variant, size, sigma);
+		 smoothCurrentFrame(variant->smooth, size, sigma);
+		 if (!colorMat.empty() && !marked.empty()) {
+			 marked.copyTo(colorMat);
+		 }
+		 id.lastDetectTime = stats.detectTime;
+		 id.contourCount = stats.contourCount;
+		 id.contourPoints = stats.contourPoints;
+		 logStage(variant->name, "cache hit", start, runClock() - start, id.contourCount);
+		 return true;
+	 }
+
+	 variant->detect(argv, mat, colorMat);
+	 stats.detectTime = id.lastDetectTime;
+	 stats.contourCount = id.contourCount;
+	 stats.contourPoints = id.contourPoints;
+	 resultCacheStore(key, mat, colorMat, stats);
+	 return false;
+ }
+
+/*
+ Runs one variant, then the Hough stage on its edge map when --hough is given.
+ With --perf-counters the variant (including its contour tracing) is measured as the "detect" stage. The run log
+ records the detector's own time, which is what goes in the CSV. A result served from the cache was not measured
+ in this run, so it only gets a "cache hit" record and its CSV cell stays empty.
+ - Pavel Shekhter
+ */
+ void runVariant(const VARIANT *variant, std::ofstream &file, char * argv, cv::Mat &mat, cv::Mat &colorMat) {
+	 PERFSCOPE perf;
+	 setRunVariant(variant->name);
+	 double start = runClock();
+	 perfBegin(perf, variant->name, "detect", (double)id.currentFrameGry.total());
+	 bool cached = detectCached(variant, argv, mat, colorMat);
+	 perfEnd(perf);
+	 if (!cached) {
+		 logStage(variant->name, "detect", start, id.lastDetectTime, id.contourCount);
+	 }
+	 houghStage(*variant, mat, file);
+ }
+
+/*
+ True if the variant is in --variants, or the list of the loaded profile. An empty list chooses every variant.
+ - Pavel Shekhter
+ */
+ static bool variantChosen(const char *name) {
+	 std::vector<const VARIANT *> chosen;
+	 parseVariantList(opts.variantList, chosen);
+	 return std::find(chosen.begin(), chosen.end(), findVariant(name)) != chosen.end();
+ }
+
+/*
  Perform the Canny edge detector trials.
  - Pavel Shekhter
  */
@@ -465,10 +938,12 @@ Perform Sobel edge detection using Gaussian blur
      cv::Mat colorMat;
      colorMat = id.currentFrameColor;
 	 bool isGCDone = false;
-	 std::thread gaussCanny(&gaussianCanny, std::ref(file), argv[i], std::ref(gaussCannyDet), std::ref(csv), std::ref(colorMat));
-	 if (gaussCanny.joinable()) {
-		 gaussCanny.join();
-		 isGCDone = true;
+	 if (variantChosen("canny_gaussian")) {
+		 std::thread gaussCanny(&runVariant, findVariant("canny_gaussian"), std::ref(file), argv[i], std::ref(gaussCannyDet), std::ref(colorMat));
+		 if (gaussCanny.joinable()) {
+			 gaussCanny.join();
+			 isGCDone = true;
+		 }
 	 }
 
 	 if (!gaussCannyDet.empty() || isGCDone == true) {
@@ -485,7 +960,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::bitwise_not(gaussCannyDet, gaussianCannyInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_canny_gaussian_inv_" + imp, gaussianCannyInv, comp_params);
 
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_canny_gaussian_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_canny_gaussian_marked_" + imp, colorMat, comp_params);
+                 }
 			 }
 			 catch (std::runtime_error& e) {
 				 appendErrorMessage(file, -3);
@@ -495,22 +972,19 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!gaussCannyDet.empty()) {
-		 cv::namedWindow("Canny: Gaussian", CV_WINDOW_NORMAL);
-		 cv::imshow("Canny: Gaussian", gaussCannyDet);
-		 cv::namedWindow("Canny: Gaussian Blur Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat gaussCannyInv;
-		 cv::bitwise_not(gaussCannyDet, gaussCannyInv);
-		 cv::imshow("Canny: Gaussian Blur Inverted", gaussCannyInv);
-         cv::namedWindow ("Edges: Canny Gaussian", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Canny Gaussian", colorMat);
+		 postPreview("Canny: Gaussian", gaussCannyDet);
+		 postPreview("Canny: Gaussian Blur Inverted", gaussCannyDet, true);
+		 postPreview("Edges: Canny Gaussian", colorMat);
 	 }
 
 	 cv::Mat normalizedCannyDet;
 	 bool isNCDone = false;
-	 std::thread normCanny(&normalizedCanny, std::ref(file), argv[i], std::ref(normalizedCannyDet), std::ref(csv), std::ref(colorMat));
-	 if (normCanny.joinable()) {
-		 normCanny.join();
-		 isNCDone = true;
+	 if (variantChosen("canny_normalized")) {
+		 std::thread normCanny(&runVariant, findVariant("canny_normalized"), std::ref(file), argv[i], std::ref(normalizedCannyDet), std::ref(colorMat));
+		 if (normCanny.joinable()) {
+			 normCanny.join();
+			 isNCDone = true;
+		 }
 	 }
 
 	 if (!normalizedCannyDet.empty() || isNCDone == true) {
@@ -526,7 +1000,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat normCannyInv;
 				 cv::bitwise_not(normalizedCannyDet, normCannyInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_canny_normalized_inv_" + imp, normCannyInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_canny_normalized_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_canny_normalized_marked_" + imp, colorMat, comp_params);
+                 }
 			 }
 			 catch (std::runtime_error& e) {
 				 appendErrorMessage(file, -3);
@@ -536,24 +1012,20 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!normalizedCannyDet.empty()) {
-		 cv::namedWindow("Canny: Normalized Box", CV_WINDOW_NORMAL);
-		 cv::imshow("Canny: Normalized Box", gaussCannyDet);
-		 cv::namedWindow("Canny: Normalized Box Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat normalizeddCannyInv;
-		 cv::bitwise_not(normalizedCannyDet, normalizeddCannyInv);
-		 cv::imshow("Canny: Normalized Box Inverted", normalizeddCannyInv);
-         cv::namedWindow ("Edges: Canny Normalized", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Canny Normalized", colorMat);
-
+		 postPreview("Canny: Normalized Box", normalizedCannyDet);
+		 postPreview("Canny: Normalized Box Inverted", normalizedCannyDet, true);
+		 postPreview("Edges: Canny Normalized", colorMat);
 	 }
 
 
 	 cv::Mat boxCannyDet;
 	 bool isBoxDone = false;
-	 std::thread boxCanny(&boxCanny, std::ref(file), argv[i], std::ref(boxCannyDet), std::ref(csv), std::ref(colorMat));
-	 if (boxCanny.joinable()) {
-		 boxCanny.join();
-		 isBoxDone = true;
+	 if (variantChosen("canny_box")) {
+		 std::thread boxCanny(&runVariant, findVariant("canny_box"), std::ref(file), argv[i], std::ref(boxCannyDet), std::ref(colorMat));
+		 if (boxCanny.joinable()) {
+			 boxCanny.join();
+			 isBoxDone = true;
+		 }
 	 }
 
 	 if (!boxCannyDet.empty() || isBoxDone == true) {
@@ -569,7 +1041,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat boxCannyInv;
 				 cv::bitwise_not(boxCannyDet, boxCannyInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_canny_box_inv_" + imp, boxCannyInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_canny_box_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_canny_box_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -580,15 +1054,9 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!boxCannyDet.empty()) {
-		 cv::namedWindow("Canny: Box Filter", CV_WINDOW_NORMAL);
-		 cv::imshow("Canny: Box Filter", boxCannyDet);
-		 cv::namedWindow("Canny: Box Filter Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat boxCannyInv;
-		 cv::bitwise_not(boxCannyDet, boxCannyInv);
-		 cv::imshow("Canny: Box Filter Inverted", boxCannyInv);
-         cv::namedWindow ("Edges: Canny Box", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Canny Box", colorMat);
-
+		 postPreview("Canny: Box Filter", boxCannyDet);
+		 postPreview("Canny: Box Filter Inverted", boxCannyDet, true);
+		 postPreview("Edges: Canny Box", colorMat);
 	 }
  }
 
@@ -602,10 +1070,12 @@ Perform Sobel edge detection using Gaussian blur
      cv::Mat colorMat;
      colorMat = id.currentFrameColor;
 	 bool isGLDone = false;
-	 std::thread gaussLaplace(&gausianLaplace, std::ref(file), argv[i], std::ref(gaussLaplaceDet), std::ref(csv), std::ref(colorMat));
-	 if (gaussLaplace.joinable()) {
-		 gaussLaplace.join();
-		 isGLDone = true;
+	 if (variantChosen("laplace_gaussian")) {
+		 std::thread gaussLaplace(&runVariant, findVariant("laplace_gaussian"), std::ref(file), argv[i], std::ref(gaussLaplaceDet), std::ref(colorMat));
+		 if (gaussLaplace.joinable()) {
+			 gaussLaplace.join();
+			 isGLDone = true;
+		 }
 	 }
 
 	 if (!gaussLaplaceDet.empty() || isGLDone == true) {
@@ -621,7 +1091,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat gaussLaplaceInv;
 				 cv::bitwise_not(gaussLaplaceDet, gaussLaplaceInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_laplace_gaussian_inv_" + imp, gaussLaplaceInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_laplace_gaussian_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_laplace_gaussian_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -632,23 +1104,19 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!gaussLaplaceDet.empty()) {
-		 cv::namedWindow("Laplacian: Gaussian", CV_WINDOW_NORMAL);
-		 cv::imshow("Laplacian: Gaussian", gaussLaplaceDet);
-		 cv::namedWindow("Laplacian: Gaussian Blur Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat gaussLaplaceInv;
-		 cv::bitwise_not(gaussLaplaceDet, gaussLaplaceInv);
-		 cv::imshow("Laplacian: Gaussian Blur Inverted", gaussLaplaceInv);
-         cv::namedWindow ("Edges: Laplacian Gaussian", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Laplacian Gaussian", colorMat);
-
+		 postPreview("Laplacian: Gaussian", gaussLaplaceDet);
+		 postPreview("Laplacian: Gaussian Blur Inverted", gaussLaplaceDet, true);
+		 postPreview("Edges: Laplacian Gaussian", colorMat);
 	 }
 
 	 cv::Mat normalizedLaplaceDet;
 	 bool isNLDone = false;
-     std::thread normLaplace (&normalizedLaplace, std::ref (file), argv[i], std::ref (normalizedLaplaceDet), std::ref (csv), std::ref (colorMat));
-     if (normLaplace.joinable()) {
-		 normLaplace.join();
-		 isNLDone = true;
+	 if (variantChosen("laplace_normalized")) {
+		 std::thread normLaplace (&runVariant, findVariant("laplace_normalized"), std::ref (file), argv[i], std::ref (normalizedLaplaceDet), std::ref (colorMat));
+		 if (normLaplace.joinable()) {
+			 normLaplace.join();
+			 isNLDone = true;
+		 }
 	 }
 
 	 if (!normalizedLaplaceDet.empty() || isNLDone == true) {
@@ -664,7 +1132,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat normLaplaceInv;
 				 cv::bitwise_not(normalizedLaplaceDet, normLaplaceInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_laplace_normalized_inv_" + imp, normLaplaceInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_laplace_normalized_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_laplace_normalized_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -675,23 +1145,19 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!normalizedLaplaceDet.empty()) {
-		 cv::namedWindow("Laplacian: Normalized", CV_WINDOW_NORMAL);
-		 cv::imshow("Laplacian: Normalized", normalizedLaplaceDet);
-		 cv::namedWindow("Laplacian: Normalized Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat normLaplaceInv;
-		 cv::bitwise_not(normalizedLaplaceDet, normLaplaceInv);
-		 cv::imshow("Laplacian: Normalized Inverted", normLaplaceInv);
-         cv::namedWindow ("Edges: Laplacian Normalized", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Laplacian Normalized", colorMat);
-
+		 postPreview("Laplacian: Normalized", normalizedLaplaceDet);
+		 postPreview("Laplacian: Normalized Inverted", normalizedLaplaceDet, true);
+		 postPreview("Edges: Laplacian Normalized", colorMat);
 	 }
 
 	 cv::Mat boxLaplaceDet;
 	 bool isBLDone = false;
-	 std::thread boxLaplace (&boxLaplace, std::ref(file), argv[i], std::ref(boxLaplaceDet), std::ref(csv), std::ref(colorMat));
-	 if (boxLaplace.joinable()) {
-		 boxLaplace.join();
-		 isBLDone = true;
+	 if (variantChosen("laplace_box")) {
+		 std::thread boxLaplace (&runVariant, findVariant("laplace_box"), std::ref(file), argv[i], std::ref(boxLaplaceDet), std::ref(colorMat));
+		 if (boxLaplace.joinable()) {
+			 boxLaplace.join();
+			 isBLDone = true;
+		 }
 	 }
 
 	 if (!boxLaplaceDet.empty() || isBLDone == true) {
@@ -707,7 +1173,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat boxLaplaceInv;
 				 cv::bitwise_not(boxLaplaceDet, boxLaplaceInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_laplace_box_inv_" + imp, boxLaplaceInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_laplace_box_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_laplace_box_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -718,15 +1186,9 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!boxLaplaceDet.empty()) {
-		 cv::namedWindow("Laplacian: Box Filter", CV_WINDOW_NORMAL);
-		 cv::namedWindow("Laplacian: Box Filter Inverted", CV_WINDOW_NORMAL);
-		 cv::imshow("Laplacian: Box Filter", boxLaplaceDet);
-		 cv::Mat boxLaplaceInv;
-		 cv::bitwise_not(boxLaplaceDet, boxLaplaceInv);
-		 cv::imshow("Laplacian: Box Filter Inverted", boxLaplaceInv);
-         cv::namedWindow ("Edges: Laplacian Box", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Laplacian Box", colorMat);
-
+		 postPreview("Laplacian: Box Filter", boxLaplaceDet);
+		 postPreview("Laplacian: Box Filter Inverted", boxLaplaceDet, true);
+		 postPreview("Edges: Laplacian Box", colorMat);
 	 }
  }
 
@@ -740,10 +1202,12 @@ Perform Sobel edge detection using Gaussian blur
      cv::Mat colorMat;
      colorMat = id.currentFrameColor;
 	 bool isGSDone = false;
-	 std::thread gaussSobel(&gaussianSobel, std::ref(file), argv[i], std::ref(gaussSobelMat), std::ref(csv), std::ref(colorMat));
-	 if (gaussSobel.joinable()) {
-		 gaussSobel.join();
-		 isGSDone = true;
+	 if (variantChosen("sobel_gaussian")) {
+		 std::thread gaussSobel(&runVariant, findVariant("sobel_gaussian"), std::ref(file), argv[i], std::ref(gaussSobelMat), std::ref(colorMat));
+		 if (gaussSobel.joinable()) {
+			 gaussSobel.join();
+			 isGSDone = true;
+		 }
 	 }
 
 	 if (!gaussSobelMat.empty() || isGSDone == true) {
@@ -759,7 +1223,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat gaussSobelInv;
 				 cv::bitwise_not(gaussSobelMat, gaussSobelInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_sobel_gaussian_inv_" + imp, gaussSobelInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_sobel_gaussian_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_sobel_gaussian_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -770,23 +1236,19 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!gaussSobelMat.empty()) {
-		 cv::namedWindow("Sobel: Gaussian", CV_WINDOW_NORMAL);
-		 cv::imshow("Sobel: Gaussian", gaussSobelMat);
-		 cv::namedWindow("Sobel: Gaussian Blur Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat gaussSobelInv;
-		 cv::bitwise_not(gaussSobelMat, gaussSobelInv);
-		 cv::imshow("Sobel: Gaussian Blur Inverted", gaussSobelInv);
-         cv::namedWindow ("Edges: Sobel Gaussian", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Sobel Gaussian", colorMat);
-
+		 postPreview("Sobel: Gaussian", gaussSobelMat);
+		 postPreview("Sobel: Gaussian Blur Inverted", gaussSobelMat, true);
+		 postPreview("Edges: Sobel Gaussian", colorMat);
 	 }
 
 	 cv::Mat normalizedSobelMat;
 	 bool isNSDone = false;
-	 std::thread normSobel(&normalizedSobel, std::ref(file), argv[i], std::ref(normalizedSobelMat), std::ref(csv), std::ref(colorMat));
-	 if (normSobel.joinable()) {
-		 normSobel.join();
-		 isNSDone = true;
+	 if (variantChosen("sobel_normalized")) {
+		 std::thread normSobel(&runVariant, findVariant("sobel_normalized"), std::ref(file), argv[i], std::ref(normalizedSobelMat), std::ref(colorMat));
+		 if (normSobel.joinable()) {
+			 normSobel.join();
+			 isNSDone = true;
+		 }
 	 }
 
 	 if (!normalizedSobelMat.empty() || isNSDone == true) {
@@ -802,7 +1264,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat normSobelInv;
 				 cv::bitwise_not(normalizedSobelMat, normSobelInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_sobel_normalized_inv_" + imp, normSobelInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_sobel_normalized_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_sobel_normalized_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -813,23 +1277,19 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!normalizedSobelMat.empty()) {
-		 cv::namedWindow("Sobel: Normalized", CV_WINDOW_NORMAL);
-		 cv::imshow("Sobel: Normalized", normalizedSobelMat);
-		 cv::namedWindow("Sobel: Normalized Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat normSobelInv;
-		 cv::bitwise_not(normalizedSobelMat, normSobelInv);
-		 cv::imshow("Sobel: Normalized Inverted", normSobelInv);
-         cv::namedWindow ("Edges: Sobel Normalized", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Sobel Normalized", colorMat);
-
+		 postPreview("Sobel: Normalized", normalizedSobelMat);
+		 postPreview("Sobel: Normalized Inverted", normalizedSobelMat, true);
+		 postPreview("Edges: Sobel Normalized", colorMat);
 	 }
 
 	 cv::Mat boxSobelMat;
 	 bool isBSDone = false;
-     std::thread boxSobel (&boxSobel, std::ref (file), argv[i], std::ref (boxSobelMat), std::ref (csv), std::ref (colorMat));
-	 if (boxSobel.joinable()) {
-		 boxSobel.join();
-		 isBSDone = true;
+	 if (variantChosen("sobel_box")) {
+		 std::thread boxSobel (&runVariant, findVariant("sobel_box"), std::ref (file), argv[i], std::ref (boxSobelMat), std::ref (colorMat));
+		 if (boxSobel.joinable()) {
+			 boxSobel.join();
+			 isBSDone = true;
+		 }
 	 }
 
 	 if (!boxSobelMat.empty() || isBSDone == true) {
@@ -845,7 +1305,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat boxSobelInv;
 				 cv::bitwise_not(boxSobelMat, boxSobelInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_sobel_box_inv_" + imp, boxSobelInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_sobel_box_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_sobel_box_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -856,15 +1318,9 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!boxSobelMat.empty()) {
-		 cv::namedWindow("Sobel: Box Filter", CV_WINDOW_NORMAL);
-		 cv::namedWindow("Sobel: Box Filter Inverted", CV_WINDOW_NORMAL);
-		 cv::imshow("Sobel: Box Filter", boxSobelMat);
-		 cv::Mat boxSobelInv;
-		 cv::bitwise_not(boxSobelMat, boxSobelInv);
-		 cv::imshow("Sobel: Box Filter Inverted", boxSobelInv);
-         cv::namedWindow ("Edges: Sobel Box", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Sobel Box", colorMat);
-
+		 postPreview("Sobel: Box Filter", boxSobelMat);
+		 postPreview("Sobel: Box Filter Inverted", boxSobelMat, true);
+		 postPreview("Edges: Sobel Box", colorMat);
 	 }
  }
 
@@ -878,10 +1334,12 @@ Perform Sobel edge detection using Gaussian blur
      cv::Mat colorMat;
      colorMat = id.currentFrameColor;
 	 bool isGDone = false;
-	 std::thread gabor (&gabor, std::ref(file), argv[i], std::ref(gaborDet), std::ref(csv), std::ref(colorMat));
-	 if (gabor.joinable()) {
-		 gabor.join();
-		 isGDone = true;
+	 if (variantChosen("gabor")) {
+		 std::thread gabor (&runVariant, findVariant("gabor"), std::ref(file), argv[i], std::ref(gaborDet), std::ref(colorMat));
+		 if (gabor.joinable()) {
+			 gabor.join();
+			 isGDone = true;
+		 }
 	 }
 
 	 if (!gaborDet.empty() || isGDone == true) {
@@ -897,7 +1355,9 @@ Perform Sobel edge detection using Gaussian blur
 				 cv::Mat gaborInv;
 				 cv::bitwise_not(gaborDet, gaborInv);
 				 save = cv::imwrite("trial_" + std::to_string(trial) + "_gabor_inv_" + imp, gaborInv, comp_params);
-                 save = cv::imwrite ("trial_" + std::to_string (trial) + "_gabor_marked_" + imp, colorMat, comp_params);
+                 if (!colorMat.empty ()) {
+                     save = cv::imwrite ("trial_" + std::to_string (trial) + "_gabor_marked_" + imp, colorMat, comp_params);
+                 }
 
 			 }
 			 catch (std::runtime_error& e) {
@@ -908,15 +1368,9 @@ Perform Sobel edge detection using Gaussian blur
 	 }
 
 	 if (!gaborDet.empty()) {
-		 cv::namedWindow("Gabor", CV_WINDOW_NORMAL);
-		 cv::imshow("Gabor", gaborDet);
-		 cv::namedWindow("Gabor Inverted", CV_WINDOW_NORMAL);
-		 cv::Mat gaborInv;
-		 cv::bitwise_not(gaborDet, gaborInv);
-		 cv::imshow("Gabor Inverted", gaborInv);
-         cv::namedWindow ("Edges: Gabor", CV_WINDOW_NORMAL);
-         cv::imshow ("Edges: Gabor", colorMat);
-
+		 postPreview("Gabor", gaborDet);
+		 postPreview("Gabor Inverted", gaborDet, true);
+		 postPreview("Edges: Gabor", colorMat);
 	 }
 
  }
@@ -927,60 +1381,183 @@ Perform Sobel edge detection using Gaussian blur
 	 std::ofstream file;
 	 std::ofstream csv;
 
-	if (!(argc > 1)) {
-		std::cout << "Usage: CompVisionProject imageToLoad" << std::endl;
+	std::vector<std::string> commandLine(argv, argv + argc);
+	std::vector<char *> images;
+
+	// The profile is loaded before the other options are parsed, so those given explicitly on the command line win
+	for (int a = 1; a < argc; ++a) {
+		if (std::string(argv[a]).compare(0, 10, "--profile=") == 0) {
+			opts.profileFile = argv[a] + 10;
+		}
+	}
+	if (!opts.profileFile.empty() && !loadProfile(opts.profileFile)) {
+		appendErrorMessage(std::cout, -2);
+		return -2;
+	}
+
+	if (!parseOptions(argc, argv, images)) {
 		appendErrorMessage(std::cout, -2);
 		return -2;
 	}
 
-	std::string report;
-	
-	std::cout << "Enter report file name: " << std::endl;
-	getline(std::cin, report);
+	// Every mode runs only the variants of --variants or the profile, so an unknown name is refused up front
+	std::vector<const VARIANT *> chosenVariants;
+	if (!parseVariantList(opts.variantList, chosenVariants)) {
+		appendErrorMessage(std::cout, -2);
+		return -2;
+	}
 
+	int firstTrial = 0;
+	int repeats = 0;
+	std::string report;
 	std::string csvString;
+	if (!opts.workerShard.empty() && !openShard(opts.workerShard, images, firstTrial, repeats, report, csvString)) {
+		appendErrorMessage(std::cout, -2);
+		return -2;
+	}
+
+	if (!opts.servePath.empty()) {
+		return runService(opts.servePath);
+	}
+
+	if (!opts.compareFile.empty()) {
+		if (opts.baselineFile.empty()) {
+			std::cout << "--compare needs --baseline=file" << std::endl;
+			appendErrorMessage(std::cout, -2);
+			return -2;
+		}
+		return runCompare();
+	}
+
+	if (!opts.tuneProfile.empty() && images.size() > 1) {
+		return runTuner(std::vector<std::string>(images.begin() + 1, images.end()));
+	}
 
-	std::cout << "Enter name of CSV: " << std::endl;
-	getline(std::cin, csvString);
+	if (!(images.size() > 1)) {
+		std::cout << "Usage: CompVisionProject [--gray] [--marked] [--scale=1|2|4|8] [--no-cache] [--cache-dir=dir] [--hough=lines|circles|both] [--no-preview] [--variants=a,b,...] [--tile-budget=MB] [--perf-counters=file] [--thin=otsu|adaptive] [--batch=N] [--blur=canny|laplace|sobel|all:size[:sigma]] [--smooth-engine=auto|opencv|constant] [--profile=file] [--run-log=file] imageToLoad" << std::endl;
+		std::cout << "       CompVisionProject [--gray] [--marked] [--scale=1|2|4|8] [--no-cache] [--cache-dir=dir] --serve=socketPath|- [--service-log=file] [--run-log=file]" << std::endl;
+		std::cout << "       CompVisionProject --tune=profile.txt [--tune-budget=seconds] [--tune-quality=0.5] sampleImage..." << std::endl;
+		std::cout << "       CompVisionProject --workers=N [--pin] [--shard-dir=dir] [--shard-transport=shm|file] [--shard-launch=local|none] [--shard-timeout=seconds] [options] imageToLoad..." << std::endl;
+		std::cout << "       CompVisionProject --compare=new.csv --baseline=baseline.csv [--alpha=0.05] [--effect=0.05]" << std::endl;
+		appendErrorMessage(std::cout, -2);
+		return -2;
+	}
+	argc = (int)images.size();
+	argv = images.data();
+	if (!shardWorker()) {
+		repeats = argc - 1;
+	}
 
-	std::cout << "How many trials do you want?" << std::endl;
-	getline(std::cin, cyclesString);
-	cycles = std::stoi(cyclesString);
+	// A worker runs the one trial its shard file names, into the report and CSV named there
+	if (shardWorker()) {
+		cycles = 1;
+	}
+	else {
+		std::cout << "Enter report file name: " << std::endl;
+		getline(std::cin, report);
+
+		std::cout << "Enter name of CSV: " << std::endl;
+		getline(std::cin, csvString);
+
+		std::cout << "How many trials do you want?" << std::endl;
+		getline(std::cin, cyclesString);
+		cycles = std::stoi(cyclesString);
+	}
 
 	file.open(report);
 	csv.open(csvString);
 
 	setUpFile(file, report, csv);
+	startRunLog();
+	RUNLOGSCOPE runLog(file, csv);
+
+	if (opts.workers > 0) {
+		int retval = runCoordinator(file, std::vector<std::string>(argv + 1, argv + argc), cycles, commandLine);
+		finishRunLog(file, csv);
+		file.close();
+		return retval;
+	}
 
-	for (int trials = 0; trials < cycles; ++trials) {
-		file << "Starting trial " << trials << std::endl;
+	startPreview();
+	PREVIEWSCOPE preview;
+
+	for (int trials = firstTrial; trials < firstTrial + cycles; ++trials) {
+		file << "Starting trial " << trials << "\n";
 		for (int i = 1; i < argc; i++) {
+			setPerfContext(trials, argv[i]);
+			if (opts.tileBudgetMB > 0) {
+				setRunContext(trials, i, argv[i]);
+				int retval = runTiledImage(file, argv[i], trials);
+				if (retval != 0) {
+					closeShard(retval);
+					return retval;
+				}
+				shardImageDone(i);
+				continue;
+			}
+
+			if (opts.batchSize > 1) {
+				std::vector<std::string> batch(argv + i, argv + std::min(argc, i + opts.batchSize));
+				int retval = runAtlasBatch(file, batch, i, trials);
+				if (retval != 0) {
+					closeShard(retval);
+					return retval;
+				}
+				for (size_t b = 0; b < batch.size(); ++b) {
+					shardImageDone(i + (int)b);
+				}
+				i += (int)batch.size() - 1;
+				continue;
+			}
+
 			bool retflag;
 			int retval = parseArguments(argc, argv[i], file, retflag);
-			if (retflag) return retval;
+			if (retflag) {
+				closeShard(retval);
+				return retval;
+			}
 
-			cv::namedWindow("Computer Vision Demo", CV_WINDOW_NORMAL);
-			cv::imshow("Computer Vision Demo", id.currentFrameColor);
-			cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_BGR2GRAY);
+			if (opts.grayDirect) {
+				postPreview("Computer Vision Demo", id.currentFrameGry);
+			}
+			else {
+				postPreview("Computer Vision Demo", id.currentFrameColor);
+				cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_BGR2GRAY);
+			}
 
-			for (int currentArg = 1; currentArg < argc; ++currentArg) {
-				csv << "Trial #" << trials << " File #" << currentArg << ", ";
+			// Every repeat is a row of the same image, so the CSV keys each file by its place on the command line. Each
+			// image runs once per image on the command line; a worker gets that count from its coordinator's run
+			for (int currentArg = 1; currentArg <= repeats; ++currentArg) {
+				setRunContext(trials, i, argv[i]);
 				laplaceTrial(file, argv, i, trials, csv, currentArg);
 				cannyTrial(file, argv, i, trials, csv, currentArg);
 				sobelTrial(file, argv, i, trials, csv, currentArg);
 				gaborTrial(file, argv, i, trials, csv, currentArg);
-				csv << "\n";
 			}
 
-			printf("Finished running edge detection Trial #%d. Press Esc to quit. Images and report will be found in folder where CompVisionDemo.exe is located.\n", i);
-			cv::waitKey(0);
+			if (opts.preview) {
+				printf("Finished running edge detection Trial #%d. Press Esc to quit. Images and report will be found in folder where CompVisionDemo.exe is located.\n", i);
+				waitPreviewKey();
+			}
+			else {
+				printf("Finished running edge detection Trial #%d. Images and report will be found in folder where CompVisionDemo.exe is located.\n", i);
+			}
+			shardImageDone(i);
 
 		}
-		csv << "\n";
-		file << "Trial #" << trials << " ended.\n" << std::endl;
+		file << "Trial #" << trials << " ended.\n\n";
 	}
 
+	int dropped = stopPreview();
+	if (opts.preview) {
+		file << "Preview frames dropped as stale: " << dropped << "\n";
+	}
+	finishRunLog(file, csv);
+	appendCacheReport(file);
+	appendHoughReport(file);
+	appendPerfReport(file);
 	file.close();
+	closeShard(0);
 
 	return 0;
 }
@@ -1,5 +1,167 @@
 #pragma once
 
-int parseArguments(int argc, char ** argv, std::ofstream &file, bool &retflag);
+#include <opencv2/core/core.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
 
-void cannyTrial(std::ofstream &file, char ** argv, int i, int trial);
+struct IMAGEDATA {
+	cv::Mat currentFrameColor;
+	cv::Mat currentFrameGry;
+	cv::Mat cannyGaussianDetectedEdges;
+	cv::Mat cannyNormalizedDetectedEdges;
+    cv::Mat cannyBoxDetectedEdges;
+	cv::Mat laplaceDest;
+	cv::Mat sobelGrad;
+	cv::Mat sobelXGrad;
+	cv::Mat sobelYGrad;
+	cv::Mat sobelAbsXGrad;
+	cv::Mat sobelAbsYGrad;
+	cv::Mat gaborDest;
+	std::vector<cv::Mat> gaborKernels;
+	cv::Mat gaborSrc_f;
+    cv::Mat imgForegroundCGD;
+    cv::Mat imgForegroundCND;
+    cv::Mat imgForegroundCBD;
+    cv::Mat imgForegroundLGD;
+    cv::Mat imgForegroundLND;
+    cv::Mat imgForegroundLBD;
+    cv::Mat imgForegroundSGD;
+    cv::Mat imgForegroundSND;
+    cv::Mat imgForegroundSBD;
+    cv::Mat imgForegroundGab;
+	int canny_lowThresh = 0;
+	int canny_Ratio = 3;
+	int canny_Kernel = 3;
+	int laplace_kernel = 3;
+	int laplace_scale = 1;
+	int laplace_delta = 0;
+	int laplace_ddepth = CV_16S;
+	int sobel_scale = 1;
+	int sobel_delta = 0;
+	int sobel_ddepth = CV_16S;
+	int gaborKernelSize = 31;
+	double gaborSig = 4.0, gaborTh = 45.0, gaborLm = 10.0, gaborGm = 0.5, gaborPs = 0;
+	int canny_blurSize = 3;          // smoothing aperture of each detector family (odd)
+	double canny_blurSigma = 0;      // and its Gaussian sigma (0 = from the aperture)
+	int laplace_blurSize = 3;
+	double laplace_blurSigma = 0;
+	int sobel_blurSize = 3;
+	double sobel_blurSigma = 0;
+	double lastDetectTime = 0;       // ms taken by the last detector, as written to the CSV
+	int contourCount = 0;            // contours found by the last findContours
+	long long contourPoints = 0;     // points over all of those contours
+	cv::Rect contourRegion;          // when set, findContours only counts contours that start inside it
+};
+
+enum THINMODE { THIN_NONE, THIN_OTSU, THIN_ADAPTIVE };
+enum SMOOTHENGINE { ENGINE_AUTO, ENGINE_OPENCV, ENGINE_CONSTANT };
+enum SHARDTRANSPORT { SHARD_SHM, SHARD_FILE };
+
+/*
+	Options given on the command line ahead of the image files.
+	- Pavel Shekhter
+*/
+struct RUNOPTIONS {
+	bool grayDirect = false;    // --gray: decode straight to greyscale
+	bool markContours = true;   // --marked: also decode the colour plane for marked overlays
+	int analysisScale = 1;      // --scale=N: analyse at 1/N resolution (1, 2, 4 or 8)
+	std::string servePath;      // --serve=PATH: run as a service on a Unix domain socket, or on stdin/stdout for "-"
+	std::string serviceLog;     // --service-log=FILE: report file for service mode
+	bool useCache = true;       // --no-cache: always run the detectors, e.g. when collecting timing samples
+	std::string cacheDir = "result_cache";  // --cache-dir=DIR: where cached edge maps and statistics are kept
+	bool houghLines = false;    // --hough=lines|circles|both: run the Hough stage on every variant's edge map
+	bool houghCircles = false;
+	double houghSample = 1.0;   // --hough-sample=F: fraction of edge pixels that vote
+	int houghThreshold = 100;   // --hough-threshold=N: votes a line needs (before sampling)
+	int houghEdgeThreshold = 0; // --hough-edge-threshold=N: pixels above N count as edges
+	int houghMinRadius = 10;    // --hough-radius=min:max[:step]: circle radii to search (max 0 = half the image)
+	int houghMaxRadius = 100;
+	int houghRadiusStep = 2;
+	double houghCircleRatio = 0.5;  // --hough-circle-ratio=F: fraction of the circumference a circle needs
+	int houghMaxResults = 20;   // --hough-limit=N: lines and circles reported per edge map
+	bool preview = true;        // --no-preview: run headless, without the preview windows
+	int previewSize = 640;      // --preview-size=N: longest side of a preview frame, in pixels
+	std::string variantList;    // --variants=a,b,... or the profile's variant: variants to run (default all)
+	double tileBudgetMB = 0;    // --tile-budget=MB: process in tiles streamed from disk under this working set
+	int tileOverlap = 0;        // --tile-overlap=N: tile halo in pixels (0 sizes it from the kernels)
+	std::string perfCounterFile;  // --perf-counters=FILE: per-thread hardware counters for each stage (Linux)
+	THINMODE thinMode = THIN_NONE;  // --thin=otsu|adaptive: threshold and thin the Sobel, Laplacian and Gabor responses
+	int thinBlock = 15;         // --thin-block=N: neighbourhood of the adaptive threshold (odd)
+	double thinOffset = 5;      // --thin-offset=N: how far above its neighbourhood mean an adaptive edge must be
+	int batchSize = 0;          // --batch=N: process the images N at a time in a shared atlas (greyscale)
+	int atlasWidth = 2048;      // --atlas-width=N: widest row of a batch atlas, in pixels
+	std::string tuneProfile;    // --tune=FILE: search for the fastest configuration meeting --tune-quality and write it here
+	double tuneBudget = 60;     // --tune-budget=S: seconds the search may take
+	double tuneQuality = 0.5;   // --tune-quality=F: smallest edge quality (F1 against a LoG reference) to accept
+	std::string profileFile;    // --profile=FILE: load a variant and parameters written by --tune
+	std::string runLogFile;     // --run-log=FILE: write every stage record as a JSON line
+	std::string compareFile;    // --compare=FILE: compare this results CSV against --baseline and exit
+	std::string baselineFile;   // --baseline=FILE: results CSV of the reference run
+	double compareAlpha = 0.05; // --alpha=P: significance level of the comparison
+	double compareEffect = 0.05;  // --effect=F: smallest relative change of the median that counts
+	SMOOTHENGINE smoothEngine = ENGINE_AUTO;  // --smooth-engine=auto|opencv|constant: filters used for the smoothing
+	int constantTimeFrom = 9;   // --constant-time-from=N: apertures from which auto uses the constant-time filters
+	int workers = 0;            // --workers=N: split the images between N worker processes
+	bool pinWorkers = false;    // --pin: pin each worker to a NUMA node
+	std::string shardDir = "shards";  // --shard-dir=DIR: shard files, worker reports and results files
+	SHARDTRANSPORT shardTransport = SHARD_SHM;  // --shard-transport=shm|file: how workers return their results
+	bool launchWorkers = true;  // --shard-launch=none: only write the worker command lines, for other hosts
+	double shardTimeout = 0;    // --shard-timeout=S: seconds a worker may run before it is killed, or with --shard-launch=none its shard given up on (required there)
+	std::string workerShard;    // --worker=FILE: run the shard described in FILE (set by the coordinator)
+};
+
+enum SMOOTHTYPE { SMOOTH_GAUSSIAN, SMOOTH_NORMALIZED_BOX, SMOOTH_BOX, SMOOTH_NONE };
+
+/*
+	Signature shared by every edge detector variant.
+	- Pavel Shekhter
+*/
+typedef void (*DETECTOR)(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+
+/*
+	A named edge detector variant, listed in the same order as the CSV columns.
+	smooth is the smoothing the detector applies to the shared frame buffers in place, or SMOOTH_NONE.
+	output is the part of the trial's edge map file name, trial_<n>_<output>_<image>, that names the variant.
+	- Pavel Shekhter
+*/
+struct VARIANT {
+	const char *name;
+	DETECTOR detect;
+	SMOOTHTYPE smooth;
+	const char *output;
+};
+
+extern IMAGEDATA id;
+extern RUNOPTIONS opts;
+extern const VARIANT variants[];
+extern const int variantCount;
+
+IMAGEDATA readImageData(std::string imagefile);
+IMAGEDATA readImageBuffer(const std::vector<uchar> &buffer);
+bool frameLoaded(const IMAGEDATA &data);
+void appendErrorMessage(std::ostream &file, int errorCode);
+const VARIANT *findVariant(const std::string &name);
+bool parseVariantList(const std::string &list, std::vector<const VARIANT *> &chosen);
+int decodeFlag(bool gray, int scale);
+bool setParameter(IMAGEDATA &data, const std::string &key, const std::string &value);
+void copyParameters(const IMAGEDATA &from, IMAGEDATA &to);
+void buildGaborKernels();
+SMOOTHTYPE variantSmoothing(const VARIANT &variant, int &size, double &sigma);
+void smoothCurrentFrame(SMOOTHTYPE type, int size, double sigma);
+void runVariant(const VARIANT *variant, std::ofstream &file, char * argv, cv::Mat &mat, cv::Mat &colorMat);
+
+int parseArguments(int argc, char * argv, std::ofstream &file, bool &retflag);
+
+void gaussianCanny(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void normalizedCanny(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void boxCanny(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void gausianLaplace(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void normalizedLaplace(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void boxLaplace(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void gaussianSobel(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void normalizedSobel(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void boxSobel(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+void gabor(char * argv, cv::Mat &mat, cv::Mat &colorMat);
+
+void cannyTrial(std::ofstream &file, char ** argv, int i, int trial, std::ofstream &csv, int argc);
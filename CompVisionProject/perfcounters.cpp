@@ -0,0 +1,275 @@
+/*
+	Hardware performance counters around the detector stages, through Linux perf_event_open. They show whether a
+	stage is compute-bound (high IPC) or memory-bound (many last-level cache misses per pixel).
+	- Pavel Shekhter
+*/
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "main.h"
+#include "perfcounters.h"
+
+enum PERFCOUNTER { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_CONTEXT_SWITCHES, PERF_COUNTERS };
+
+static const char *counterNames[PERF_COUNTERS] = { "cycles", "instructions", "llc_misses", "branch_misses", "context_switches" };
+
+/*
+	Counter sums for one (variant, stage) over all threads and runs. A counter that could not be opened stays -1.
+	- Pavel Shekhter
+*/
+struct PERFTOTALS {
+	int runs = 0;
+	double pixels = 0;
+	long long counts[PERF_COUNTERS] = { -1, -1, -1, -1, -1 };
+};
+
+static std::mutex perfLock;
+static std::ofstream perfCsv;
+static std::map<std::pair<std::string, std::string>, PERFTOTALS> perfTotals;
+static std::vector<std::pair<std::string, std::string> > perfOrder;
+static int perfTrial = 0;
+static std::string perfImage;
+static thread_local std::string currentVariant;
+
+void setPerfContext(int trial, const std::string &image) {
+	std::lock_guard<std::mutex> guard(perfLock);
+	perfTrial = trial;
+	perfImage = image;
+}
+
+#ifdef __linux__
+/*
+	Opens one counter on one thread, counting user space only. With a leader the counter joins the leader's group,
+	so the kernel only ever schedules the group as a whole and ratios such as IPC compare counts taken over the same
+	time; otherwise the counter starts disabled and is enabled on its own. Every counter reports how long it was
+	enabled and running, so counts can be scaled when the kernel multiplexes. Returns -1 if the counter is not
+	available, e.g. hardware events inside a virtual machine.
+	- Pavel Shekhter
+*/
+static int openCounter(int tid, PERFCOUNTER counter, int leader) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.disabled = leader < 0 ? 1 : 0;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	switch (counter) {
+		case PERF_CYCLES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case PERF_INSTRUCTIONS:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case PERF_LLC_MISSES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CACHE_MISSES;
+			break;
+		case PERF_BRANCH_MISSES:
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+			break;
+		default:
+			attr.type = PERF_TYPE_SOFTWARE;
+			attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+			attr.exclude_kernel = 0;
+			break;
+	}
+	return (int)syscall(__NR_perf_event_open, &attr, tid, -1, leader, 0);
+}
+
+/*
+	True for the counters opened in the group led by the thread's cycles counter.
+	- Pavel Shekhter
+*/
+static bool groupMember(const std::vector<int> &fds, int counter) {
+	return fds[PERF_CYCLES] >= 0 && (counter == PERF_INSTRUCTIONS || counter == PERF_LLC_MISSES || counter == PERF_BRANCH_MISSES);
+}
+
+/*
+	Lists the thread ids of this process, which include OpenCV's worker pool.
+	- Pavel Shekhter
+*/
+static std::vector<int> processThreads() {
+	std::vector<int> threads;
+	DIR *dir = opendir("/proc/self/task");
+	if (dir == NULL) {
+		threads.push_back((int)syscall(SYS_gettid));
+		return threads;
+	}
+	while (dirent *entry = readdir(dir)) {
+		if (entry->d_name[0] != '.') {
+			threads.push_back(std::atoi(entry->d_name));
+		}
+	}
+	closedir(dir);
+	return threads;
+}
+#endif
+
+void perfBegin(PERFSCOPE &scope, const std::string &variant, const std::string &stage, double pixels) {
+	scope.variant = variant.empty() ? currentVariant : variant;
+	scope.stage = stage;
+	scope.pixels = pixels;
+	scope.threads.clear();
+	scope.fds.clear();
+	if (opts.perfCounterFile.empty()) {
+		return;
+	}
+	if (!variant.empty()) {
+		currentVariant = variant;
+	}
+
+#ifdef __linux__
+	scope.threads = processThreads();
+	scope.fds.assign(scope.threads.size(), std::vector<int>(PERF_COUNTERS, -1));
+	for (size_t t = 0; t < scope.threads.size(); ++t) {
+		// The hardware counters form one group under cycles; the context switch counter is a software event and
+		// is never multiplexed
+		std::vector<int> &fds = scope.fds[t];
+		fds[PERF_CYCLES] = openCounter(scope.threads[t], PERF_CYCLES, -1);
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			if (c != PERF_CYCLES) {
+				fds[c] = openCounter(scope.threads[t], (PERFCOUNTER)c, groupMember(fds, c) ? fds[PERF_CYCLES] : -1);
+			}
+		}
+	}
+	for (size_t t = 0; t < scope.fds.size(); ++t) {
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			if (scope.fds[t][c] >= 0 && !groupMember(scope.fds[t], c)) {
+				ioctl(scope.fds[t][c], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+				ioctl(scope.fds[t][c], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+			}
+		}
+	}
+#endif
+}
+
+void perfEnd(PERFSCOPE &scope) {
+	if (scope.fds.empty()) {
+		return;
+	}
+
+	std::vector<std::vector<long long> > counts(scope.fds.size(), std::vector<long long>(PERF_COUNTERS, -1));
+#ifdef __linux__
+	for (size_t t = 0; t < scope.fds.size(); ++t) {
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			if (scope.fds[t][c] >= 0 && !groupMember(scope.fds[t], c)) {
+				ioctl(scope.fds[t][c], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+			}
+		}
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			if (scope.fds[t][c] < 0) {
+				continue;
+			}
+			// value, time enabled, time running; a counter that was multiplexed is scaled up to the time it was
+			// enabled, and one that never ran is unknown
+			unsigned long long value[3];
+			if (read(scope.fds[t][c], value, sizeof(value)) == sizeof(value) && value[2] > 0) {
+				counts[t][c] = value[2] < value[1] ? (long long)((double)value[0] * value[1] / value[2]) : (long long)value[0];
+			}
+		}
+		// Members go before their leader
+		for (int c = PERF_COUNTERS - 1; c >= 0; --c) {
+			if (scope.fds[t][c] >= 0) {
+				close(scope.fds[t][c]);
+			}
+		}
+	}
+#endif
+	scope.fds.clear();
+
+	std::lock_guard<std::mutex> guard(perfLock);
+	if (!perfCsv.is_open()) {
+		perfCsv.open(opts.perfCounterFile);
+		perfCsv << "Trial #, Image, Variant, Stage, Thread, Pixels";
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			perfCsv << ", " << counterNames[c];
+		}
+		perfCsv << ", IPC, LLC bytes per pixel\n";
+	}
+
+	std::pair<std::string, std::string> key(scope.variant, scope.stage);
+	if (perfTotals.find(key) == perfTotals.end()) {
+		perfOrder.push_back(key);
+	}
+	PERFTOTALS &totals = perfTotals[key];
+	totals.runs++;
+	totals.pixels += scope.pixels;
+
+	for (size_t t = 0; t < counts.size(); ++t) {
+		const std::vector<long long> &row = counts[t];
+		// Threads that did no work during the stage only add noise to the CSV
+		bool counted = false;
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			counted = counted || row[c] > 0;
+		}
+		if (!counted) {
+			continue;
+		}
+		perfCsv << perfTrial << ", " << perfImage << ", " << scope.variant << ", " << scope.stage << ", " << scope.threads[t] << ", " << scope.pixels;
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			perfCsv << ", " << row[c];
+			if (row[c] >= 0) {
+				totals.counts[c] = (totals.counts[c] < 0 ? 0 : totals.counts[c]) + row[c];
+			}
+		}
+		perfCsv << ", ";
+		if (row[PERF_CYCLES] > 0 && row[PERF_INSTRUCTIONS] >= 0) {
+			perfCsv << (double)row[PERF_INSTRUCTIONS] / row[PERF_CYCLES];
+		}
+		perfCsv << ", ";
+		if (row[PERF_LLC_MISSES] >= 0 && scope.pixels > 0) {
+			perfCsv << row[PERF_LLC_MISSES] * 64.0 / scope.pixels;
+		}
+		perfCsv << "\n";
+	}
+}
+
+void appendPerfReport(std::ostream &file) {
+	if (opts.perfCounterFile.empty()) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(perfLock);
+	file << "Performance counters (all threads, per run), also per thread in " << opts.perfCounterFile << ":\n";
+	if (perfOrder.empty()) {
+		file << "  No counters were collected.\n";
+		return;
+	}
+	for (size_t i = 0; i < perfOrder.size(); ++i) {
+		const PERFTOTALS &totals = perfTotals[perfOrder[i]];
+		file << "  " << perfOrder[i].first << " " << perfOrder[i].second << ":";
+		for (int c = 0; c < PERF_COUNTERS; ++c) {
+			file << " " << counterNames[c] << "=";
+			if (totals.counts[c] < 0) {
+				file << "n/a";
+			}
+			else {
+				file << totals.counts[c] / totals.runs;
+			}
+		}
+		if (totals.counts[PERF_CYCLES] > 0 && totals.counts[PERF_INSTRUCTIONS] >= 0) {
+			file << " IPC=" << (double)totals.counts[PERF_INSTRUCTIONS] / totals.counts[PERF_CYCLES];
+		}
+		if (totals.counts[PERF_LLC_MISSES] >= 0 && totals.pixels > 0) {
+			file << " LLC bytes/pixel=" << totals.counts[PERF_LLC_MISSES] * 64.0 / totals.pixels;
+		}
+		file << "\n";
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+	Hardware counters for one stage (a detector, or findContours inside it), opened on every thread of the process.
+	Only used with --perf-counters on Linux; elsewhere the scope does nothing.
+	- Pavel Shekhter
+*/
+struct PERFSCOPE {
+	std::string variant;
+	std::string stage;
+	double pixels = 0;
+	std::vector<int> threads;
+	std::vector<std::vector<int> > fds;
+};
+
+/*
+	Sets the trial and image written with each counter row.
+	- Pavel Shekhter
+*/
+void setPerfContext(int trial, const std::string &image);
+
+/*
+	Opens and starts the counters for a stage. An empty variant means the variant of the enclosing stage on
+	this thread, so findContours is attributed to the detector that called it.
+	- Pavel Shekhter
+*/
+void perfBegin(PERFSCOPE &scope, const std::string &variant, const std::string &stage, double pixels);
+
+/*
+	Stops and reads the counters, writes one row per thread to the --perf-counters CSV and adds the stage to the
+	report totals. Counts the kernel had to multiplex are scaled by the time the counter was enabled over the time
+	it ran.
+	- Pavel Shekhter
+*/
+void perfEnd(PERFSCOPE &scope);
+
+/*
+	Appends the per-stage counter totals with IPC and LLC bytes per pixel to the report.
+	- Pavel Shekhter
+*/
+void appendPerfReport(std::ostream &file);
@@ -0,0 +1,143 @@
+/*
+	Preview renderer. Detection threads drop frames into per-window mailboxes and carry on; a single render thread
+	draws whatever is newest and runs the HighGUI event loop.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <opencv2/highgui.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "main.h"
+#include "preview.h"
+
+/*
+	The latest frame posted to one window.
+	- Pavel Shekhter
+*/
+struct PREVIEWSLOT {
+	cv::Mat frame;
+	bool inverted = false;
+	bool fresh = false;
+};
+
+static std::map<std::string, PREVIEWSLOT> slots;
+static std::mutex slotsLock;
+static std::condition_variable keyPressed;
+static std::thread renderThread;
+static std::atomic<bool> running(false);
+static int keyCount = 0;
+static int lastKey = -1;
+static int droppedFrames = 0;
+
+/*
+	Draws fresh frames and pumps the HighGUI event loop until stopPreview is called.
+	- Pavel Shekhter
+*/
+static void renderLoop() {
+	std::set<std::string> created;
+	std::vector<std::pair<std::string, PREVIEWSLOT> > toDraw;
+
+	for (;;) {
+		{
+			std::lock_guard<std::mutex> guard(slotsLock);
+			if (!running) {
+				break;
+			}
+			for (std::map<std::string, PREVIEWSLOT>::iterator it = slots.begin(); it != slots.end(); ++it) {
+				if (it->second.fresh) {
+					toDraw.push_back(std::make_pair(it->first, it->second));
+					it->second.fresh = false;
+					it->second.frame.release();
+				}
+			}
+		}
+
+		for (size_t i = 0; i < toDraw.size(); ++i) {
+			const std::string &window = toDraw[i].first;
+			PREVIEWSLOT &slot = toDraw[i].second;
+			if (created.insert(window).second) {
+				cv::namedWindow(window, CV_WINDOW_NORMAL);
+			}
+			if (slot.inverted) {
+				cv::bitwise_not(slot.frame, slot.frame);
+			}
+			cv::imshow(window, slot.frame);
+		}
+		toDraw.clear();
+
+		int key = cv::waitKey(15);
+		if (key >= 0) {
+			std::lock_guard<std::mutex> guard(slotsLock);
+			lastKey = key;
+			keyCount++;
+			keyPressed.notify_all();
+		}
+	}
+
+	cv::destroyAllWindows();
+}
+
+void startPreview() {
+	if (!opts.preview || running.exchange(true)) {
+		return;
+	}
+	renderThread = std::thread(&renderLoop);
+}
+
+void postPreview(const std::string &window, const cv::Mat &frame, bool inverted) {
+	if (!running || frame.empty()) {
+		return;
+	}
+
+	// Downscale (which also copies) on the caller, so only the small frame crosses over to the render thread
+	cv::Mat small;
+	double scale = (double)opts.previewSize / std::max(frame.cols, frame.rows);
+	if (scale < 1.0) {
+		cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_NEAREST);
+	}
+	else {
+		small = frame.clone();
+	}
+
+	std::lock_guard<std::mutex> guard(slotsLock);
+	PREVIEWSLOT &slot = slots[window];
+	if (slot.fresh) {
+		droppedFrames++;
+	}
+	slot.frame = small;
+	slot.inverted = inverted;
+	slot.fresh = true;
+}
+
+int waitPreviewKey() {
+	std::unique_lock<std::mutex> lock(slotsLock);
+	if (!running) {
+		return -1;
+	}
+	int seen = keyCount;
+	keyPressed.wait(lock, [seen]() { return keyCount != seen || !running; });
+	return keyCount != seen ? lastKey : -1;
+}
+
+int stopPreview() {
+	{
+		std::lock_guard<std::mutex> guard(slotsLock);
+		if (!running) {
+			return droppedFrames;
+		}
+		running = false;
+		keyPressed.notify_all();
+	}
+	renderThread.join();
+	slots.clear();
+	return droppedFrames;
+}
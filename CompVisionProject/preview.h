@@ -0,0 +1,44 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <string>
+
+/*
+	Starts the preview render thread, unless --no-preview was given. All HighGUI windows are created, drawn and
+	pumped on that thread, so the detectors never wait on the GUI.
+	- Pavel Shekhter
+*/
+void startPreview();
+
+/*
+	Hands a frame to the render thread for the named window. The frame is downscaled to --preview-size and copied,
+	so the caller may keep modifying it. Each window holds only its latest frame; a frame that has not been drawn
+	yet when the next one arrives is dropped. inverted frames are inverted by the render thread when drawn.
+	Empty frames are ignored.
+	- Pavel Shekhter
+*/
+void postPreview(const std::string &window, const cv::Mat &frame, bool inverted = false);
+
+/*
+	Waits until a key is pressed in any preview window and returns it. Returns -1 straight away when the preview
+	is off.
+	- Pavel Shekhter
+*/
+int waitPreviewKey();
+
+/*
+	Stops the render thread and closes the windows. Returns the number of frames dropped as stale.
+	- Pavel Shekhter
+*/
+int stopPreview();
+
+/*
+	Stops the preview when it goes out of scope, so a return on an error path does not leave the render thread
+	running. Stopping it explicitly first is fine.
+	- Pavel Shekhter
+*/
+struct PREVIEWSCOPE {
+	~PREVIEWSCOPE() {
+		stopPreview();
+	}
+};
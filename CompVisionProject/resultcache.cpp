@@ -0,0 +1,143 @@
+/*
+	On-disk result cache. Entries live in <cache dir>/<key>/ as edges.png, marked.png (when there is a colour plane)
+	and stats.txt, so a rerun with the same frames and parameters skips the detectors and contour tracing.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <boost/filesystem.hpp>
+#include "main.h"
+#include "resultcache.h"
+
+static std::atomic<int> cacheHits(0);
+static std::atomic<int> cacheMisses(0);
+static std::atomic<int> cacheStores(0);
+
+/*
+	Mixes a block of bytes into a 64-bit hash, eight bytes at a time.
+	- Pavel Shekhter
+*/
+static unsigned long long hashBytes(unsigned long long h, const uchar *p, size_t n) {
+	const unsigned long long prime = 0x100000001b3ULL;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		unsigned long long word;
+		memcpy(&word, p + i, 8);
+		h = (h ^ word) * prime;
+		h ^= h >> 29;
+	}
+	for (; i < n; ++i) {
+		h = (h ^ p[i]) * prime;
+	}
+	return h;
+}
+
+/*
+	Hashes the size, type and pixels of a matrix, row by row so submatrices hash the same as copies.
+	- Pavel Shekhter
+*/
+static unsigned long long hashMat(unsigned long long h, const cv::Mat &mat) {
+	int header[3] = { mat.rows, mat.cols, mat.type() };
+	h = hashBytes(h, (const uchar *)header, sizeof(header));
+	size_t rowBytes = mat.cols * mat.elemSize();
+	for (int y = 0; y < mat.rows; ++y) {
+		h = hashBytes(h, mat.ptr(y), rowBytes);
+	}
+	return h;
+}
+
+/*
+	Version of the detectors' output. Bump it whenever a change makes a detector produce a different edge map or
+	contour count for the same input, so entries made by older code are no longer found.
+	2: the Sobel variants take their y gradient with dy = 1 (fixed with --thin).
+	- Pavel Shekhter
+*/
+static const int cacheVersion = 2;
+
+std::string resultCacheKey(const VARIANT &variant, const IMAGEDATA &data) {
+	std::ostringstream params;
+	params << "v" << cacheVersion << " " << variant.name << " " << data.canny_lowThresh << " " << data.canny_Ratio << " " << data.canny_Kernel << " "
+		<< data.laplace_kernel << " " << data.laplace_scale << " " << data.laplace_delta << " " << data.laplace_ddepth << " "
+		<< data.sobel_scale << " " << data.sobel_delta << " " << data.sobel_ddepth << " "
+		<< data.gaborKernelSize << " " << data.gaborSig << " " << data.gaborTh << " " << data.gaborLm << " " << data.gaborGm << " " << data.gaborPs << " "
+		<< data.canny_blurSize << " " << data.canny_blurSigma << " " << data.laplace_blurSize << " " << data.laplace_blurSigma << " "
+		<< data.sobel_blurSize << " " << data.sobel_blurSigma << " " << opts.smoothEngine << " " << opts.constantTimeFrom << " "
+		<< opts.grayDirect << " " << opts.markContours << " " << opts.analysisScale << " "
+		<< opts.thinMode << " " << opts.thinBlock << " " << opts.thinOffset << " "
+		<< data.contourRegion.x << " " << data.contourRegion.y << " " << data.contourRegion.width << " " << data.contourRegion.height;
+	std::string text = params.str();
+
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	h = hashBytes(h, (const uchar *)text.data(), text.size());
+	h = hashMat(h, data.currentFrameGry);
+	h = hashMat(h, data.currentFrameColor);
+
+	char key[17];
+	snprintf(key, sizeof(key), "%016llx", h);
+	return key;
+}
+
+bool resultCacheLookup(const std::string &key, cv::Mat &edges, cv::Mat &marked, RESULTSTATS &stats) {
+	if (!opts.useCache) {
+		return false;
+	}
+
+	boost::filesystem::path entry = boost::filesystem::path(opts.cacheDir) / key;
+	std::ifstream statsFile((entry / "stats.txt").generic_string());
+	if (!(statsFile >> stats.detectTime >> stats.contourCount >> stats.contourPoints)) {
+		++cacheMisses;
+		return false;
+	}
+
+	edges = cv::imread((entry / "edges.png").generic_string(), cv::IMREAD_UNCHANGED);
+	marked.release();
+	if (boost::filesystem::exists(entry / "marked.png")) {
+		marked = cv::imread((entry / "marked.png").generic_string(), cv::IMREAD_UNCHANGED);
+	}
+	if (edges.empty()) {
+		++cacheMisses;
+		return false;
+	}
+
+	++cacheHits;
+	return true;
+}
+
+void resultCacheStore(const std::string &key, const cv::Mat &edges, const cv::Mat &marked, const RESULTSTATS &stats) {
+	if (!opts.useCache || edges.empty()) {
+		return;
+	}
+
+	boost::filesystem::path entry = boost::filesystem::path(opts.cacheDir) / key;
+	try {
+		boost::filesystem::create_directories(entry);
+		cv::imwrite((entry / "edges.png").generic_string(), edges);
+		if (!marked.empty()) {
+			cv::imwrite((entry / "marked.png").generic_string(), marked);
+		}
+	}
+	catch (std::exception& e) {
+		fprintf(stderr, "Unable to write cache entry due to: %s\n", e.what());
+		return;
+	}
+
+	std::ofstream statsFile((entry / "stats.txt").generic_string());
+	statsFile << stats.detectTime << " " << stats.contourCount << " " << stats.contourPoints << "\n";
+	++cacheStores;
+}
+
+void appendCacheReport(std::ostream &file) {
+	if (!opts.useCache) {
+		file << "Result cache: disabled\n";
+		return;
+	}
+	file << "Result cache (" << opts.cacheDir << "): " << cacheHits << " hits, " << cacheMisses << " misses, "
+		<< cacheStores << " entries stored\n";
+}
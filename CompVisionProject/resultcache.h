@@ -0,0 +1,44 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <ostream>
+#include <string>
+#include "main.h"
+
+/*
+	What a cache entry holds besides the edge map: the detector time measured when the entry was made
+	and the contour statistics from findContours.
+	- Pavel Shekhter
+*/
+struct RESULTSTATS {
+	double detectTime = 0;
+	int contourCount = 0;
+	long long contourPoints = 0;
+};
+
+/*
+	Builds the cache key for running a variant on the current frame: a hash of the frame buffers as the variant
+	will see them, the variant name, the detector parameters, the decode options, the region findContours counts in
+	and the version of the detectors' output.
+	- Pavel Shekhter
+*/
+std::string resultCacheKey(const VARIANT &variant, const IMAGEDATA &data);
+
+/*
+	Looks up a cache entry. marked is left empty if the entry has no marked overlay.
+	Returns false on a miss, or if the cache is disabled.
+	- Pavel Shekhter
+*/
+bool resultCacheLookup(const std::string &key, cv::Mat &edges, cv::Mat &marked, RESULTSTATS &stats);
+
+/*
+	Stores a cache entry. The statistics file is written last, so an entry interrupted by a crash is never read back.
+	- Pavel Shekhter
+*/
+void resultCacheStore(const std::string &key, const cv::Mat &edges, const cv::Mat &marked, const RESULTSTATS &stats);
+
+/*
+	Appends the cache hit/miss counters to the report.
+	- Pavel Shekhter
+*/
+void appendCacheReport(std::ostream &file);
@@ -0,0 +1,431 @@
+/*
+	Lock-free per-thread record buffers and the background flusher behind the structured run log.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "main.h"
+#include "runlog.h"
+#include "shard.h"
+
+/*
+	One timed stage. Fixed size, so records can be copied in and out of the ring buffers without allocating.
+	- Pavel Shekhter
+*/
+struct RUNRECORD {
+	int row;
+	char variant[24];
+	char stage[12];
+	double startMs;
+	double ms;
+	long long count;
+};
+
+/*
+	A CSV row: one trial of one file.
+	- Pavel Shekhter
+*/
+struct RUNROW {
+	int trial;
+	int image;
+	std::string imagefile;
+};
+
+/*
+	Records waiting per thread before the flusher must catch up.
+	- Pavel Shekhter
+*/
+static const size_t runBufferSize = 1024;
+
+/*
+	A single-producer, single-consumer ring of records. The owning thread only advances tail and the flusher only
+	advances head. Buffers are never freed: when a thread exits its buffer is released for the next thread to
+	claim, since the trials start a thread per variant.
+	- Pavel Shekhter
+*/
+struct RUNBUFFER {
+	RUNRECORD records[runBufferSize];
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::atomic<bool> owned;
+	RUNBUFFER *next;
+};
+
+static std::atomic<RUNBUFFER *> runBuffers(nullptr);
+static std::atomic<bool> logging(false);
+static std::atomic<bool> stopFlusher(false);
+static std::atomic<int> currentRow(-1);
+static std::thread flusher;
+static std::string runIdText;
+static double runStart = 0;
+
+static std::mutex rowsLock;
+static std::vector<RUNROW> rows;
+
+// Held by the flusher while it drains, and by flushRunLog while it renders
+static std::mutex collectedLock;
+static std::vector<RUNRECORD> collected;
+static std::ofstream runLogFile;
+
+static thread_local std::string stageVariant;
+
+/*
+	Releases the thread's buffer when the thread exits.
+	- Pavel Shekhter
+*/
+struct BUFFERHOLDER {
+	RUNBUFFER *buffer = nullptr;
+	~BUFFERHOLDER() {
+		if (buffer != nullptr) {
+			buffer->owned.store(false, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local BUFFERHOLDER holder;
+
+static double nowMs() {
+	return (cv::getTickCount()) / (cv::getTickFrequency()) * 1000;
+}
+
+/*
+	Claims a released buffer, or adds a new one to the list.
+	- Pavel Shekhter
+*/
+static RUNBUFFER *claimBuffer() {
+	for (RUNBUFFER *b = runBuffers.load(std::memory_order_acquire); b != nullptr; b = b->next) {
+		bool expected = false;
+		if (b->owned.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+			return b;
+		}
+	}
+
+	RUNBUFFER *b = new RUNBUFFER();
+	b->head.store(0);
+	b->tail.store(0);
+	b->owned.store(true);
+	b->next = runBuffers.load(std::memory_order_relaxed);
+	while (!runBuffers.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed)) {}
+	return b;
+}
+
+static void copyName(char *to, size_t size, const std::string &from) {
+	size_t n = std::min(size - 1, from.size());
+	memcpy(to, from.data(), n);
+	to[n] = '\0';
+}
+
+static std::string jsonString(const std::string &text) {
+	std::string quoted = "\"";
+	for (size_t i = 0; i < text.size(); ++i) {
+		if (text[i] == '"' || text[i] == '\\') {
+			quoted += '\\';
+		}
+		quoted += text[i];
+	}
+	return quoted + "\"";
+}
+
+/*
+	Moves every record waiting in the buffers into the collected list, and into the --run-log file.
+	- Pavel Shekhter
+*/
+static void drainBuffers() {
+	size_t first = collected.size();
+	for (RUNBUFFER *b = runBuffers.load(std::memory_order_acquire); b != nullptr; b = b->next) {
+		size_t head = b->head.load(std::memory_order_relaxed);
+		size_t tail = b->tail.load(std::memory_order_acquire);
+		for (; head != tail; ++head) {
+			collected.push_back(b->records[head % runBufferSize]);
+		}
+		b->head.store(head, std::memory_order_release);
+	}
+	if (!runLogFile.is_open() || first == collected.size()) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(rowsLock);
+	for (size_t i = first; i < collected.size(); ++i) {
+		const RUNRECORD &r = collected[i];
+		const RUNROW *row = r.row >= 0 ? &rows[r.row] : NULL;
+		runLogFile << "{\"run\":" << jsonString(runIdText) << ",\"trial\":" << (row ? row->trial : -1) << ",\"image\":" << (row ? row->image : -1)
+			<< ",\"file\":" << jsonString(row ? row->imagefile : "") << ",\"variant\":" << jsonString(r.variant) << ",\"stage\":" << jsonString(r.stage)
+			<< ",\"start_ms\":" << r.startMs << ",\"ms\":" << r.ms << ",\"count\":" << r.count << "}\n";
+	}
+	runLogFile.flush();
+}
+
+static void flushLoop() {
+	while (!stopFlusher.load(std::memory_order_acquire)) {
+		{
+			std::lock_guard<std::mutex> guard(collectedLock);
+			drainBuffers();
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+	std::lock_guard<std::mutex> guard(collectedLock);
+	drainBuffers();
+}
+
+void startRunLog() {
+	if (logging.load()) {
+		return;
+	}
+	char text[32];
+	snprintf(text, sizeof(text), "%llx", (unsigned long long)std::chrono::system_clock::now().time_since_epoch().count());
+	runIdText = text;
+	runStart = nowMs();
+	if (!opts.runLogFile.empty()) {
+		runLogFile.open(opts.runLogFile);
+	}
+	stopFlusher.store(false);
+	logging.store(true, std::memory_order_release);
+	flusher = std::thread(&flushLoop);
+}
+
+const std::string &runId() {
+	return runIdText;
+}
+
+double runClock() {
+	return nowMs() - runStart;
+}
+
+void setRunContext(int trial, int image, const std::string &imagefile) {
+	std::lock_guard<std::mutex> guard(rowsLock);
+	RUNROW row;
+	row.trial = trial;
+	row.image = image;
+	row.imagefile = imagefile;
+	rows.push_back(row);
+	currentRow.store((int)rows.size() - 1, std::memory_order_release);
+}
+
+void setRunVariant(const std::string &variant) {
+	stageVariant = variant;
+}
+
+void logStage(const std::string &variant, const char *stage, double startMs, double ms, long long count) {
+	if (!logging.load(std::memory_order_acquire)) {
+		return;
+	}
+	if (holder.buffer == nullptr) {
+		holder.buffer = claimBuffer();
+	}
+	RUNBUFFER *b = holder.buffer;
+
+	// A full buffer waits for the flusher rather than losing records
+	size_t tail = b->tail.load(std::memory_order_relaxed);
+	while (tail - b->head.load(std::memory_order_acquire) >= runBufferSize) {
+		std::this_thread::yield();
+	}
+
+	RUNRECORD &r = b->records[tail % runBufferSize];
+	r.row = currentRow.load(std::memory_order_acquire);
+	copyName(r.variant, sizeof(r.variant), variant.empty() ? stageVariant : variant);
+	copyName(r.stage, sizeof(r.stage), stage);
+	r.startMs = startMs;
+	r.ms = ms;
+	r.count = count;
+	b->tail.store(tail + 1, std::memory_order_release);
+
+	// A worker also reports every detect stage to its coordinator as it happens
+	if (shardWorker() && r.row >= 0 && strcmp(stage, "detect") == 0) {
+		std::lock_guard<std::mutex> guard(rowsLock);
+		shardRecord(rows[r.row].imagefile, r.variant, ms, count);
+	}
+}
+
+/*
+	Totals for one (variant, stage) in the report summary.
+	- Pavel Shekhter
+*/
+struct STAGESUMMARY {
+	int runs = 0;
+	double total = 0;
+	double min = 0;
+	double max = 0;
+};
+
+// The summary covers every record of the run, including those of rows already rendered by flushRunLog
+static std::map<std::pair<std::string, std::string>, STAGESUMMARY> summary;
+static std::vector<std::pair<std::string, std::string> > order;
+static size_t renderedRecords = 0;
+
+static bool startedBefore(const RUNRECORD *a, const RUNRECORD *b) {
+	return a->startMs < b->startMs;
+}
+
+/*
+	The report line of one detector stage, in place of the lines the detectors used to write as they ran. r holds the
+	summed time and count of the stage's calls in the row, e.g. one per tile. Returns false for the stages that only
+	go in the summary.
+	- Pavel Shekhter
+*/
+static bool reportStage(std::ostream &file, const RUNRECORD &r, int calls) {
+	std::string over = calls > 1 ? " over " + std::to_string(calls) + " calls" : "";
+	const char *variant = r.variant[0] ? r.variant : "-";
+	if (strcmp(r.stage, "detect") == 0) {
+		file << "  " << variant << " started at " << r.startMs << " ms, finished at " << r.startMs + r.ms << " ms and took "
+			<< r.ms << " ms to complete" << over;
+		if (r.count >= 0) {
+			file << ", " << r.count << " contours";
+		}
+		file << ".\n";
+	}
+	else if (strcmp(r.stage, "cache hit") == 0) {
+		file << "  " << variant << " served from the result cache in " << r.ms << " ms, " << r.count << " contours" << over << "; not timed.\n";
+	}
+	else if (strcmp(r.stage, "thin") == 0) {
+		file << "  " << variant << " thinned to " << r.count << " edge pixels in " << r.ms << " ms" << over << ".\n";
+	}
+	else if (strcmp(r.stage, "contours") == 0) {
+		file << "  " << variant << " found " << r.count << " contours in " << r.ms << " ms" << over << ".\n";
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+/*
+	Writes the CSV rows and report lines of the collected records, adds them to the summary, then drops the records
+	and rows. The caller holds collectedLock or has joined the flusher.
+	- Pavel Shekhter
+*/
+static void renderRows(std::ostream &file, std::ostream &csv) {
+	std::lock_guard<std::mutex> guard(rowsLock);
+
+	// CSV rows, with a blank line after each trial as the trials always wrote them
+	std::vector<std::vector<double> > detectTimes(rows.size(), std::vector<double>(variantCount, -1));
+	for (size_t i = 0; i < collected.size(); ++i) {
+		const RUNRECORD &r = collected[i];
+		if (r.row >= 0 && strcmp(r.stage, "detect") == 0) {
+			const VARIANT *v = findVariant(r.variant);
+			if (v != NULL) {
+				double &cell = detectTimes[r.row][v - variants];
+				cell = (cell < 0 ? 0 : cell) + r.ms;
+			}
+		}
+
+		std::pair<std::string, std::string> key(r.variant, r.stage);
+		if (summary.find(key) == summary.end()) {
+			order.push_back(key);
+		}
+		STAGESUMMARY &s = summary[key];
+		s.min = s.runs ? std::min(s.min, r.ms) : r.ms;
+		s.max = s.runs ? std::max(s.max, r.ms) : r.ms;
+		s.runs++;
+		s.total += r.ms;
+	}
+
+	for (size_t row = 0; row < rows.size(); ++row) {
+		if (std::count(detectTimes[row].begin(), detectTimes[row].end(), -1.0) == variantCount) {
+			continue;
+		}
+		csv << "Trial #" << rows[row].trial << " File #" << rows[row].image << " (" << rows[row].imagefile << "), ";
+		for (int v = 0; v < variantCount; ++v) {
+			if (detectTimes[row][v] >= 0) {
+				csv << detectTimes[row][v];
+			}
+			csv << ", ";
+		}
+		csv << "\n";
+		if (row + 1 == rows.size() || rows[row + 1].trial != rows[row].trial) {
+			csv << "\n";
+		}
+	}
+
+	// The detectors' lines, per row in the order their stages first started. The calls of one stage of one variant
+	// (one per tile in tiled mode) are summed into a single line.
+	std::vector<std::vector<const RUNRECORD *> > rowRecords(rows.size());
+	for (size_t i = 0; i < collected.size(); ++i) {
+		if (collected[i].row >= 0) {
+			rowRecords[collected[i].row].push_back(&collected[i]);
+		}
+	}
+	for (size_t row = 0; row < rows.size(); ++row) {
+		std::stable_sort(rowRecords[row].begin(), rowRecords[row].end(), startedBefore);
+		std::vector<RUNRECORD> stages;
+		std::vector<int> calls;
+		for (size_t i = 0; i < rowRecords[row].size(); ++i) {
+			const RUNRECORD &r = *rowRecords[row][i];
+			size_t s = 0;
+			while (s < stages.size() && (strcmp(stages[s].variant, r.variant) != 0 || strcmp(stages[s].stage, r.stage) != 0)) {
+				++s;
+			}
+			if (s == stages.size()) {
+				stages.push_back(r);
+				calls.push_back(1);
+				continue;
+			}
+			stages[s].ms += r.ms;
+			stages[s].count = stages[s].count >= 0 && r.count >= 0 ? stages[s].count + r.count : -1;
+			calls[s]++;
+		}
+
+		bool heading = false;
+		for (size_t i = 0; i < stages.size(); ++i) {
+			std::ostringstream line;
+			if (!reportStage(line, stages[i], calls[i])) {
+				continue;
+			}
+			if (!heading) {
+				file << "Trial #" << rows[row].trial << " File #" << rows[row].image << " (" << rows[row].imagefile << "):\n";
+				heading = true;
+			}
+			file << line.str();
+		}
+	}
+
+	renderedRecords += collected.size();
+	collected.clear();
+	rows.clear();
+	currentRow.store(-1, std::memory_order_release);
+}
+
+void flushRunLog(std::ostream &file, std::ostream &csv) {
+	if (!logging.load(std::memory_order_acquire)) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(collectedLock);
+	drainBuffers();
+	renderRows(file, csv);
+}
+
+void finishRunLog(std::ostream &file, std::ostream &csv) {
+	if (!logging.exchange(false)) {
+		return;
+	}
+	stopFlusher.store(true, std::memory_order_release);
+	flusher.join();
+	runLogFile.close();
+	renderRows(file, csv);
+
+	file << "Run " << runIdText << ": " << renderedRecords << " stage records";
+	if (!opts.runLogFile.empty()) {
+		file << ", written to " << opts.runLogFile;
+	}
+	file << ".\n";
+	file << "Stage timings (runs, mean / min / max ms):\n";
+	for (size_t i = 0; i < order.size(); ++i) {
+		const STAGESUMMARY &s = summary[order[i]];
+		file << "  " << (order[i].first.empty() ? "-" : order[i].first) << " " << order[i].second << ": " << s.runs << ", "
+			<< s.total / s.runs << " / " << s.min << " / " << s.max << "\n";
+	}
+	summary.clear();
+	order.clear();
+	renderedRecords = 0;
+}
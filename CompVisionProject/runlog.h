@@ -0,0 +1,80 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+
+/*
+	Structured run log. Every timed stage becomes a record (run id, trial, image, variant, stage, start and duration)
+	appended to a buffer owned by the calling thread, without locks; a background thread drains the buffers and, with
+	--run-log, writes the records as JSON lines. The CSV rows and the stage summary of the report are produced from
+	the records when the run finishes, instead of being written as the stages run.
+	- Pavel Shekhter
+*/
+
+/*
+	Starts the flusher and picks the run id. Records logged before this, or after finishRunLog, are dropped.
+	- Pavel Shekhter
+*/
+void startRunLog();
+
+/*
+	The id of this run, as written with every record.
+	- Pavel Shekhter
+*/
+const std::string &runId();
+
+/*
+	Starts a new CSV row for the given trial and file number; the records that follow belong to it.
+	- Pavel Shekhter
+*/
+void setRunContext(int trial, int image, const std::string &imagefile);
+
+/*
+	Sets the variant that stages logged on this thread without one (e.g. findContours) are attributed to.
+	- Pavel Shekhter
+*/
+void setRunVariant(const std::string &variant);
+
+/*
+	Logs one stage of the current row. An empty variant means the one set by setRunVariant on this thread.
+	count is stage-specific (contours, edge pixels), or -1. The "detect" stage is the CSV column of its variant.
+	- Pavel Shekhter
+*/
+void logStage(const std::string &variant, const char *stage, double startMs, double ms, long long count = -1);
+
+/*
+	Milliseconds since startRunLog, for the start of a stage.
+	- Pavel Shekhter
+*/
+double runClock();
+
+/*
+	Stops the flusher, writes one CSV row per context ("Trial #t File #f (image path)", then the "detect" times in
+	variant order), and appends to the report each context's detector stages (detect, cache hit, thin, contours)
+	and the per-stage timing summary. A stage a variant ran more than once in a context, e.g. once per tile, is
+	summed into one line. The detectors log these stages instead of writing to the report from their threads.
+	- Pavel Shekhter
+*/
+void finishRunLog(std::ostream &file, std::ostream &csv);
+
+/*
+	Writes the CSV rows and report lines of the contexts logged so far, as finishRunLog would, and forgets them; the
+	stage summary still covers them when the run finishes. The service calls it after every request, so its memory
+	does not grow with the number of requests.
+	- Pavel Shekhter
+*/
+void flushRunLog(std::ostream &file, std::ostream &csv);
+
+/*
+	Finishes the run log when it goes out of scope, so a return on an error path still joins the flusher and writes
+	the CSV rows logged so far. Finishing it explicitly first is fine.
+	- Pavel Shekhter
+*/
+struct RUNLOGSCOPE {
+	std::ostream &file;
+	std::ostream &csv;
+	RUNLOGSCOPE(std::ostream &file, std::ostream &csv) : file(file), csv(csv) {}
+	~RUNLOGSCOPE() {
+		finishRunLog(file, csv);
+	}
+};
@@ -0,0 +1,425 @@
+/*
+	Service mode: keeps one process alive and answers detection requests over a Unix domain socket or stdin/stdout,
+	so process startup, OpenCV initialization and Gabor kernel creation are paid once instead of per image.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <boost/filesystem.hpp>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "main.h"
+#include "service.h"
+#include "runlog.h"
+#include "resultcache.h"
+#include "hough.h"
+#include "perfcounters.h"
+
+/*
+	A blocking connection to one client. Input is buffered so request lines and image bytes can be read from the
+	same stream.
+	- Pavel Shekhter
+*/
+struct SERVICECHANNEL {
+	int inFd;
+	int outFd;
+	std::string pending;
+};
+
+enum REQUESTRESULT { REQUEST_CONTINUE, REQUEST_QUIT, REQUEST_SHUTDOWN };
+
+/*
+	Largest encoded image DETECTBYTES accepts. Larger payloads are read past and refused rather than buffered.
+	- Pavel Shekhter
+*/
+static const long long maxRequestBytes = 256LL * 1024 * 1024;
+
+/*
+	Reads more input into the channel buffer. Returns false at end of stream.
+	- Pavel Shekhter
+*/
+static bool fillChannel(SERVICECHANNEL &ch) {
+	char chunk[65536];
+#ifdef _WIN32
+	int got = _read(ch.inFd, chunk, sizeof(chunk));
+#else
+	int got = (int)read(ch.inFd, chunk, sizeof(chunk));
+#endif
+	if (got <= 0) {
+		return false;
+	}
+	ch.pending.append(chunk, got);
+	return true;
+}
+
+/*
+	Reads one line, without its line ending. Returns false at end of stream.
+	- Pavel Shekhter
+*/
+static bool readLine(SERVICECHANNEL &ch, std::string &line) {
+	size_t newline;
+	while ((newline = ch.pending.find('\n')) == std::string::npos) {
+		if (!fillChannel(ch)) {
+			return false;
+		}
+	}
+	line = ch.pending.substr(0, newline);
+	ch.pending.erase(0, newline + 1);
+	if (!line.empty() && line[line.size() - 1] == '\r') {
+		line.erase(line.size() - 1);
+	}
+	return true;
+}
+
+/*
+	Reads exactly count bytes. Returns false if the stream ends first.
+	- Pavel Shekhter
+*/
+static bool readBytes(SERVICECHANNEL &ch, size_t count, std::vector<uchar> &bytes) {
+	while (ch.pending.size() < count) {
+		if (!fillChannel(ch)) {
+			return false;
+		}
+	}
+	bytes.assign(ch.pending.begin(), ch.pending.begin() + count);
+	ch.pending.erase(0, count);
+	return true;
+}
+
+/*
+	Reads and drops count bytes without keeping them. Returns false if the stream ends first.
+	- Pavel Shekhter
+*/
+static bool skipBytes(SERVICECHANNEL &ch, size_t count) {
+	while (ch.pending.size() < count) {
+		count -= ch.pending.size();
+		ch.pending.clear();
+		if (!fillChannel(ch)) {
+			return false;
+		}
+	}
+	ch.pending.erase(0, count);
+	return true;
+}
+
+/*
+	Writes the whole reply in one go.
+	- Pavel Shekhter
+*/
+static bool writeReply(SERVICECHANNEL &ch, const std::string &reply) {
+	size_t written = 0;
+	while (written < reply.size()) {
+#ifdef _WIN32
+		int put = _write(ch.outFd, reply.data() + written, (unsigned)(reply.size() - written));
+#else
+		int put = (int)write(ch.outFd, reply.data() + written, reply.size() - written);
+#endif
+		if (put <= 0) {
+			return false;
+		}
+		written += put;
+	}
+	return true;
+}
+
+/*
+	Runs one DETECT or DETECTBYTES request and builds its reply.
+	The decoded frame is kept aside and copied into the IMAGEDATA buffers before each variant, so every variant sees
+	the unsmoothed frame and the buffers are reused from one request to the next. Parameters a request does not set
+	keep the values the service started with (the defaults, or those of --profile).
+	- Pavel Shekhter
+*/
+static std::string runDetectRequest(const std::string &source, const std::vector<uchar> *bytes, std::istringstream &args,
+	std::ofstream &log, std::ofstream &csv, int requestNumber) {
+	static const IMAGEDATA defaults = id;
+	static cv::Mat pristineColor, pristineGry, workColor, workGry;
+
+	std::vector<const VARIANT *> chosen;
+	std::string outDir;
+	bool sendEdges = false;
+
+	copyParameters(defaults, id);
+
+	std::string token;
+	while (args >> token) {
+		size_t eq = token.find('=');
+		if (eq == std::string::npos) {
+			return "ERR unexpected argument " + token + "\n";
+		}
+		std::string key = token.substr(0, eq);
+		std::string value = token.substr(eq + 1);
+
+		if (key == "variants") {
+			if (!parseVariantList(value, chosen)) {
+				return "ERR unknown variant in " + value + "\n";
+			}
+		}
+		else if (key == "out") {
+			outDir = value;
+		}
+		else if (key == "edges") {
+			sendEdges = value == "1";
+		}
+		else if (!setParameter(id, key, value)) {
+			return "ERR unknown parameter " + key + "\n";
+		}
+	}
+
+	// Without variants= a request runs those of --variants or the profile, which main checked
+	if (chosen.empty()) {
+		parseVariantList(opts.variantList, chosen);
+	}
+
+	setRunContext(requestNumber, 1, source);
+	double decodeStart = (cv::getTickCount()) / (cv::getTickFrequency());
+	if (bytes != NULL) {
+		readImageBuffer(*bytes);
+	}
+	else {
+		readImageData(source);
+	}
+	if (!frameLoaded(id)) {
+		return "ERR unable to decode " + source + "\n";
+	}
+	if (!opts.grayDirect) {
+		cv::cvtColor(id.currentFrameColor, id.currentFrameGry, cv::COLOR_BGR2GRAY);
+	}
+	double decodeTime = (cv::getTickCount()) / (cv::getTickFrequency()) - decodeStart;
+
+	// Real copies: from the second request on, the decoded frames can share memory with the work buffers that the
+	// smoothing variants blur in place
+	pristineColor = id.currentFrameColor.clone();
+	pristineGry = id.currentFrameGry.clone();
+
+	std::string stem = bytes != NULL ? "request_" + std::to_string(requestNumber) + ".jpg" : boost::filesystem::path(source).filename().generic_string();
+	std::vector<int> comp_params;
+	comp_params.push_back(CV_IMWRITE_JPEG_QUALITY);
+	comp_params.push_back(100);
+
+	std::ostringstream reply;
+	reply << "OK " << chosen.size() << " " << decodeTime * 1000 << "\n";
+
+	for (size_t v = 0; v < chosen.size(); ++v) {
+		if (pristineColor.empty()) {
+			id.currentFrameColor.release();
+		}
+		else {
+			pristineColor.copyTo(workColor);
+			id.currentFrameColor = workColor;
+		}
+		pristineGry.copyTo(workGry);
+		id.currentFrameGry = workGry;
+
+		cv::Mat det;
+		cv::Mat colorMat;
+		colorMat = id.currentFrameColor;
+		std::string name = chosen[v]->name;
+
+		double initTime = (cv::getTickCount()) / (cv::getTickFrequency());
+		runVariant(chosen[v], log, const_cast<char *>(source.c_str()), det, colorMat);
+		double finalTime = (cv::getTickCount()) / (cv::getTickFrequency());
+
+		std::string outPath = "-";
+		if (!outDir.empty() && !det.empty()) {
+			outPath = (boost::filesystem::path(outDir) / ("service_" + name + "_" + stem)).generic_string();
+			try {
+				cv::imwrite(outPath, det, comp_params);
+				if (!colorMat.empty()) {
+					cv::imwrite((boost::filesystem::path(outDir) / ("service_" + name + "_marked_" + stem)).generic_string(), colorMat, comp_params);
+				}
+			}
+			catch (std::exception& e) {
+				appendErrorMessage(log, -3);
+				fprintf(stderr, "Unable to write file due to: %s\n", e.what());
+				outPath = "-";
+			}
+		}
+
+		std::vector<uchar> edgeBytes;
+		if (sendEdges && !det.empty()) {
+			cv::imencode(".png", det, edgeBytes);
+		}
+
+		reply << name << " " << (finalTime - initTime) * 1000 << " " << outPath << " " << edgeBytes.size() << "\n";
+		reply.write((const char *)edgeBytes.data(), edgeBytes.size());
+	}
+
+	return reply.str();
+}
+
+/*
+	Answers requests on one channel until the client disconnects or asks to quit.
+	- Pavel Shekhter
+*/
+static REQUESTRESULT serveChannel(SERVICECHANNEL &ch, std::ofstream &log, std::ofstream &csv) {
+	static int requestNumber = 0;
+	std::string line;
+
+	while (readLine(ch, line)) {
+		std::istringstream args(line);
+		std::string command;
+		args >> command;
+
+		std::string reply;
+		if (command == "DETECT") {
+			std::string path;
+			args >> path;
+			reply = runDetectRequest(path, NULL, args, log, csv, ++requestNumber);
+		}
+		else if (command == "DETECTBYTES") {
+			long long count = -1;
+			args >> count;
+			std::vector<uchar> bytes;
+			if (count < 0) {
+				reply = "ERR missing byte count\n";
+			}
+			else if (count > maxRequestBytes) {
+				if (!skipBytes(ch, (size_t)count)) {
+					return REQUEST_QUIT;
+				}
+				reply = "ERR byte count over " + std::to_string(maxRequestBytes) + "\n";
+			}
+			else if (!readBytes(ch, (size_t)count, bytes)) {
+				return REQUEST_QUIT;
+			}
+			else {
+				reply = runDetectRequest("<bytes>", &bytes, args, log, csv, ++requestNumber);
+			}
+		}
+		else if (command == "QUIT") {
+			return REQUEST_QUIT;
+		}
+		else if (command == "SHUTDOWN") {
+			return REQUEST_SHUTDOWN;
+		}
+		else if (command.empty()) {
+			continue;
+		}
+		else {
+			reply = "ERR unknown command " + command + "\n";
+		}
+
+		bool sent = writeReply(ch, reply);
+
+		// The request's rows go in the report once it has been answered, rather than piling up until shutdown
+		flushRunLog(log, csv);
+		if (!sent) {
+			return REQUEST_QUIT;
+		}
+	}
+	return REQUEST_QUIT;
+}
+
+#ifndef _WIN32
+/*
+	Creates a listening Unix domain socket, replacing any stale socket file. Returns -1 on failure.
+	- Pavel Shekhter
+*/
+static int listenOn(const std::string &path) {
+	sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	unlink(path.c_str());
+
+	if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+#endif
+
+int runService(const std::string &path) {
+	std::ofstream log;
+	std::ofstream csv;
+	if (!opts.serviceLog.empty()) {
+		log.open(opts.serviceLog);
+	}
+
+	// Warm up the kernels with the default parameters before the first request arrives
+	buildGaborKernels();
+	startRunLog();
+	RUNLOGSCOPE runLog(log, csv);
+
+	if (path == "-") {
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		// stdout carries the replies, so diagnostics printed along the way go to stderr
+		std::streambuf *console = std::cout.rdbuf(std::cerr.rdbuf());
+		SERVICECHANNEL ch;
+		ch.inFd = 0;
+		ch.outFd = 1;
+		serveChannel(ch, log, csv);
+		std::cout.rdbuf(console);
+		finishRunLog(log, csv);
+		appendCacheReport(log);
+		appendHoughReport(log);
+		appendPerfReport(log);
+		return 0;
+	}
+
+#ifdef _WIN32
+	std::cout << "Unix domain sockets are not supported on this platform. Use --serve=- instead." << std::endl;
+	appendErrorMessage(std::cout, -4);
+	return -4;
+#else
+	int listener = listenOn(path);
+	if (listener < 0) {
+		std::cout << "Unable to listen on " << path << std::endl;
+		appendErrorMessage(std::cout, -4);
+		return -4;
+	}
+
+	// A client that disconnects mid-reply must not take the service down
+	signal(SIGPIPE, SIG_IGN);
+
+	REQUESTRESULT result = REQUEST_CONTINUE;
+	while (result != REQUEST_SHUTDOWN) {
+		int client = accept(listener, NULL, NULL);
+		if (client < 0) {
+			continue;
+		}
+		SERVICECHANNEL ch;
+		ch.inFd = client;
+		ch.outFd = client;
+		result = serveChannel(ch, log, csv);
+		close(client);
+	}
+
+	close(listener);
+	unlink(path.c_str());
+	finishRunLog(log, csv);
+	appendCacheReport(log);
+	appendHoughReport(log);
+	appendPerfReport(log);
+	return 0;
+#endif
+}
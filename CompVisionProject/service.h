@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+/*
+	Runs the detectors as a long-lived service, keeping the Gabor kernels, frame buffers and OpenCV's
+	worker threads warm between requests.
+	path is a Unix domain socket to listen on, or "-" to read requests from stdin and reply on stdout.
+
+	Requests are single lines:
+		DETECT <image path> [variants=a,b,...] [out=dir] [edges=1] [parameter=value ...]
+		DETECTBYTES <byte count> [same options]      followed by the encoded image bytes (at most 256 MB)
+		QUIT                                          closes the connection
+		SHUTDOWN                                      stops the service
+	Parameters are the IMAGEDATA names (canny_lowThresh=30, gaborSig=3.5, ...) and only apply to that request.
+	Without variants= a request runs the variants of --variants or --profile, by default all of them.
+
+	Replies are:
+		OK <variant count> <decode ms>
+		<variant> <ms> <output path or -> <edge map byte count>     one line per variant, followed by the PNG
+		                                                            edge map bytes when edges=1
+	or ERR <message>.
+	- Pavel Shekhter
+*/
+int runService(const std::string &path);
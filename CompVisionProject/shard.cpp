@@ -0,0 +1,869 @@
+/*
+	Multi-process sharded runs: the coordinator that splits the images between worker processes and gathers their
+	results, and the worker side of the shard protocol.
+
+	A shard file holds "key value" lines: the trial, the worker's report and CSV, where to put the results (a shared
+	memory segment or a results file) and one "image <index> <path>" line per image, index being the image's
+	position in the coordinator's list.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem.hpp>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "main.h"
+#include "shard.h"
+#include "runlog.h"
+
+/*
+	One detect stage of one variant on one repeat of an image. A shared memory segment holds a SHARDHEADER, a done
+	flag per image and then one slot per image, repeat and variant. A worker that dies leaves everything it wrote in
+	the segment, but only the slots of images it marked done are used.
+	- Pavel Shekhter
+*/
+struct SHARDSLOT {
+	double ms;
+	long long count;
+	int recorded;
+};
+
+struct SHARDHEADER {
+	int images;
+	int repeats;
+	int variants;
+};
+
+struct SHARDSEGMENT {
+	void *data = NULL;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE mapping = NULL;
+#endif
+};
+
+/*
+	One image of a shard as the worker sees it.
+	- Pavel Shekhter
+*/
+struct SHARDIMAGE {
+	int index;
+	std::string path;
+	bool done;
+	std::vector<int> recorded;
+};
+
+/*
+	What a worker reported for one image of its shard.
+	- Pavel Shekhter
+*/
+struct SHARDRESULT {
+	bool done = false;
+	std::vector<std::vector<SHARDSLOT> > samples;
+};
+
+/*
+	A worker process of the coordinator and the images of its shard it has not finished yet.
+	- Pavel Shekhter
+*/
+struct WORKER {
+	int shard = 0;
+	std::vector<int> images;
+	int launches = 0;
+	bool running = false;
+	bool timedOut = false;
+	double started = 0;
+	std::string base;
+	std::string resultsPath;
+	std::string segmentName;
+	SHARDSEGMENT segment;
+#ifdef _WIN32
+	HANDLE process = NULL;
+#else
+	pid_t pid = -1;
+#endif
+};
+
+/*
+	Times an image may bring its worker down before it is given up on.
+	- Pavel Shekhter
+*/
+static const int maxStrikes = 2;
+
+static std::vector<SHARDIMAGE> shardImages;
+static std::vector<std::string> shardPaths;
+static bool workerMode = false;
+static SHARDSEGMENT workerSegment;
+static std::ofstream workerResults;
+static std::mutex shardLock;
+
+static double nowMs() {
+	return (cv::getTickCount()) / (cv::getTickFrequency()) * 1000;
+}
+
+static size_t doneOffset() {
+	return sizeof(SHARDHEADER);
+}
+
+static size_t slotOffset(int images) {
+	return doneOffset() + (images * sizeof(int) + 7) / 8 * 8;
+}
+
+static size_t segmentSize(int images, int repeats) {
+	return slotOffset(images) + sizeof(SHARDSLOT) * images * repeats * variantCount;
+}
+
+static SHARDHEADER *segmentHeader(const SHARDSEGMENT &segment) {
+	return (SHARDHEADER *)segment.data;
+}
+
+static int *segmentDone(const SHARDSEGMENT &segment) {
+	return (int *)((char *)segment.data + doneOffset());
+}
+
+static SHARDSLOT *segmentSlots(const SHARDSEGMENT &segment) {
+	return (SHARDSLOT *)((char *)segment.data + slotOffset(segmentHeader(segment)->images));
+}
+
+/*
+	Creates (zero filled) or opens a named shared memory segment. Opening maps the whole segment.
+	- Pavel Shekhter
+*/
+static bool mapSegment(SHARDSEGMENT &segment, const std::string &name, size_t size, bool create) {
+#ifdef _WIN32
+	if (create) {
+		segment.mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, name.c_str());
+	}
+	else {
+		segment.mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	}
+	if (segment.mapping == NULL) {
+		return false;
+	}
+	segment.data = MapViewOfFile(segment.mapping, FILE_MAP_ALL_ACCESS, 0, 0, create ? size : 0);
+	if (segment.data == NULL) {
+		CloseHandle(segment.mapping);
+		segment.mapping = NULL;
+		return false;
+	}
+	segment.size = size;
+	return true;
+#else
+	int fd = shm_open(name.c_str(), create ? O_CREAT | O_RDWR | O_TRUNC : O_RDWR, 0600);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if ((create && ftruncate(fd, (off_t)size) != 0) || (!create && fstat(fd, &st) != 0)) {
+		close(fd);
+		return false;
+	}
+	if (!create) {
+		size = (size_t)st.st_size;
+	}
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	segment.data = data;
+	segment.size = size;
+	return true;
+#endif
+}
+
+static void unmapSegment(SHARDSEGMENT &segment, const std::string &name, bool remove) {
+	if (segment.data == NULL) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(segment.data);
+	CloseHandle(segment.mapping);
+	segment.mapping = NULL;
+#else
+	munmap(segment.data, segment.size);
+	if (remove) {
+		shm_unlink(name.c_str());
+	}
+#endif
+	segment.data = NULL;
+	segment.size = 0;
+}
+
+static std::string segmentName(int shard, int launch) {
+#ifdef _WIN32
+	return "Local\\cvp_" + std::to_string(GetCurrentProcessId()) + "_" + std::to_string(shard) + "_" + std::to_string(launch);
+#else
+	return "/cvp_" + std::to_string(getpid()) + "_" + std::to_string(shard) + "_" + std::to_string(launch);
+#endif
+}
+
+bool openShard(const std::string &path, std::vector<char *> &images, int &trial, int &repeats, std::string &report, std::string &csv) {
+	std::ifstream in(path);
+	if (!in) {
+		std::cout << "Can't open shard file " << path << std::endl;
+		return false;
+	}
+
+	std::string line, segment, results;
+	while (std::getline(in, line)) {
+		size_t space = line.find(' ');
+		std::string key = line.substr(0, space);
+		std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+		if (key == "trial") trial = std::atoi(value.c_str());
+		else if (key == "repeats") repeats = std::atoi(value.c_str());
+		else if (key == "report") report = value;
+		else if (key == "csv") csv = value;
+		else if (key == "segment") segment = value;
+		else if (key == "results") results = value;
+		else if (key == "image" && value.find(' ') != std::string::npos) {
+			SHARDIMAGE image;
+			image.index = std::atoi(value.c_str());
+			image.path = value.substr(value.find(' ') + 1);
+			image.done = false;
+			image.recorded.assign(variantCount, 0);
+			shardImages.push_back(image);
+		}
+		else if (!key.empty()) {
+			std::cout << "Unknown line in shard file: " << line << std::endl;
+			return false;
+		}
+	}
+
+	if (!segment.empty()) {
+		if (!mapSegment(workerSegment, segment, 0, false) || segmentHeader(workerSegment)->images != (int)shardImages.size() ||
+			segmentHeader(workerSegment)->repeats != repeats || segmentHeader(workerSegment)->variants != variantCount) {
+			std::cout << "Can't open shared memory segment " << segment << std::endl;
+			return false;
+		}
+	}
+	else {
+		workerResults.open(results, std::ios::app);
+		if (!workerResults) {
+			std::cout << "Can't open results file " << results << std::endl;
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < shardImages.size(); ++i) {
+		shardPaths.push_back(shardImages[i].path);
+	}
+	images.resize(1);
+	for (size_t i = 0; i < shardPaths.size(); ++i) {
+		images.push_back(const_cast<char *>(shardPaths[i].c_str()));
+	}
+	workerMode = true;
+	return true;
+}
+
+bool shardWorker() {
+	return workerMode;
+}
+
+void shardRecord(const std::string &imagefile, const std::string &variant, double ms, long long count) {
+	const VARIANT *v = findVariant(variant);
+	if (!workerMode || v == NULL) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(shardLock);
+	for (size_t i = 0; i < shardImages.size(); ++i) {
+		if (shardImages[i].done || shardImages[i].path != imagefile) {
+			continue;
+		}
+		int repeat = shardImages[i].recorded[v - variants]++;
+		if (workerSegment.data != NULL) {
+			// Tiled and atlas runs record one stage per image, the others one per repeat, so every stage has a slot
+			int repeats = segmentHeader(workerSegment)->repeats;
+			if (repeat < repeats) {
+				SHARDSLOT &slot = segmentSlots(workerSegment)[(i * repeats + repeat) * variantCount + (v - variants)];
+				slot.ms = ms;
+				slot.count = count;
+				slot.recorded = 1;
+			}
+		}
+		else {
+			workerResults << "detect " << i << " " << v->name << " " << ms << " " << count << "\n";
+		}
+		return;
+	}
+}
+
+void shardImageDone(int image) {
+	if (!workerMode || image < 1 || image > (int)shardImages.size()) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(shardLock);
+	shardImages[image - 1].done = true;
+	if (workerSegment.data != NULL) {
+		segmentDone(workerSegment)[image - 1] = 1;
+	}
+	else {
+		workerResults << "done " << image - 1 << "\n";
+		workerResults.flush();
+	}
+}
+
+void closeShard(int exitCode) {
+	if (!workerMode) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(shardLock);
+	if (workerResults.is_open()) {
+		workerResults << "exit " << exitCode << "\n";
+		workerResults.close();
+	}
+	unmapSegment(workerSegment, "", false);
+	workerMode = false;
+}
+
+/*
+	Quotes an argument for a command line when it needs it.
+	- Pavel Shekhter
+*/
+static std::string quoteArgument(const std::string &arg) {
+	if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos) {
+		return arg;
+	}
+	std::string quoted = "\"";
+	for (size_t i = 0; i < arg.size(); ++i) {
+		if (arg[i] == '"') {
+			quoted += '\\';
+		}
+		quoted += arg[i];
+	}
+	return quoted + "\"";
+}
+
+/*
+	The coordinator's options that a worker takes too. The run log and perf counters are the coordinator's, and
+	workers never show a preview.
+	- Pavel Shekhter
+*/
+static std::vector<std::string> workerOptions(const std::vector<std::string> &commandLine) {
+	std::vector<std::string> forwarded;
+	for (size_t i = 1; i < commandLine.size(); ++i) {
+		const std::string &arg = commandLine[i];
+		if (arg.compare(0, 2, "--") != 0 || arg.compare(0, 10, "--workers=") == 0 || arg == "--pin" || arg.compare(0, 8, "--shard-") == 0 ||
+			arg.compare(0, 10, "--run-log=") == 0 || arg.compare(0, 16, "--perf-counters=") == 0 || arg == "--no-preview") {
+			continue;
+		}
+		forwarded.push_back(arg);
+	}
+	forwarded.push_back("--no-preview");
+	return forwarded;
+}
+
+#if defined(_WIN32)
+/*
+	Processors of NUMA node (shard mod the node count); all of them when the node's mask cannot be read.
+	- Pavel Shekhter
+*/
+static DWORD_PTR workerMask(int shard) {
+	ULONG highest = 0;
+	ULONGLONG mask = 0;
+	if (GetNumaHighestNodeNumber(&highest) && GetNumaNodeProcessorMask((UCHAR)(shard % (highest + 1)), &mask) && mask != 0) {
+		return (DWORD_PTR)mask;
+	}
+	DWORD_PTR processMask = 0, systemMask = 0;
+	GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+	return processMask;
+}
+#elif defined(__linux__)
+/*
+	CPUs of NUMA node (shard mod the node count), from sysfs. Without NUMA information the CPUs are shared out
+	evenly between the workers.
+	- Pavel Shekhter
+*/
+static cpu_set_t workerCpus(int shard) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int nodes = 0;
+	while (boost::filesystem::exists("/sys/devices/system/node/node" + std::to_string(nodes))) {
+		nodes++;
+	}
+	if (nodes > 0) {
+		std::ifstream in("/sys/devices/system/node/node" + std::to_string(shard % nodes) + "/cpulist");
+		std::string list, range;
+		std::getline(in, list);
+		std::stringstream ranges(list);
+		while (std::getline(ranges, range, ',')) {
+			int first, last;
+			int got = sscanf(range.c_str(), "%d-%d", &first, &last);
+			for (int cpu = first; got >= 1 && cpu <= (got == 2 ? last : first) && cpu < CPU_SETSIZE; ++cpu) {
+				CPU_SET(cpu, &set);
+			}
+		}
+	}
+	if (CPU_COUNT(&set) == 0) {
+		int cpus = std::max(1, (int)std::thread::hardware_concurrency());
+		int share = std::max(1, cpus / std::max(1, opts.workers));
+		for (int c = 0; c < share; ++c) {
+			CPU_SET((shard * share + c) % cpus, &set);
+		}
+	}
+	return set;
+}
+#endif
+
+/*
+	Starts this program as a worker with args.
+	- Pavel Shekhter
+*/
+static bool startProcess(WORKER &worker, const std::vector<std::string> &args, const std::string &program) {
+#ifdef _WIN32
+	char path[MAX_PATH];
+	if (GetModuleFileNameA(NULL, path, MAX_PATH) == 0) {
+		return false;
+	}
+	std::string commandLine = quoteArgument(path);
+	for (size_t i = 0; i < args.size(); ++i) {
+		commandLine += " " + quoteArgument(args[i]);
+	}
+	std::vector<char> text(commandLine.begin(), commandLine.end());
+	text.push_back('\0');
+
+	STARTUPINFOA startup;
+	ZeroMemory(&startup, sizeof(startup));
+	startup.cb = sizeof(startup);
+	PROCESS_INFORMATION info;
+	if (!CreateProcessA(path, text.data(), NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, NULL, &startup, &info)) {
+		return false;
+	}
+	if (opts.pinWorkers) {
+		SetProcessAffinityMask(info.hProcess, workerMask(worker.shard));
+	}
+	ResumeThread(info.hThread);
+	CloseHandle(info.hThread);
+	worker.process = info.hProcess;
+	return true;
+#else
+	std::vector<char *> argv;
+	argv.push_back(const_cast<char *>(program.c_str()));
+	for (size_t i = 0; i < args.size(); ++i) {
+		argv.push_back(const_cast<char *>(args[i].c_str()));
+	}
+	argv.push_back(NULL);
+#ifdef __linux__
+	// Worked out before fork: the child may only make system calls until it has exec'd
+	cpu_set_t cpus = workerCpus(worker.shard);
+	const char *self = "/proc/self/exe";
+#else
+	const char *self = program.c_str();
+#endif
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		return false;
+	}
+	if (pid == 0) {
+#ifdef __linux__
+		if (opts.pinWorkers) {
+			sched_setaffinity(0, sizeof(cpus), &cpus);
+		}
+#endif
+		execv(self, argv.data());
+		_exit(127);
+	}
+	worker.pid = pid;
+	return true;
+#endif
+}
+
+/*
+	True once a started worker has exited, with its exit code.
+	- Pavel Shekhter
+*/
+static bool processExited(WORKER &worker, int &exitCode) {
+#ifdef _WIN32
+	if (WaitForSingleObject(worker.process, 0) != WAIT_OBJECT_0) {
+		return false;
+	}
+	DWORD code = 0;
+	GetExitCodeProcess(worker.process, &code);
+	CloseHandle(worker.process);
+	worker.process = NULL;
+	exitCode = (int)code;
+	return true;
+#else
+	int status = 0;
+	pid_t got = waitpid(worker.pid, &status, WNOHANG);
+	if (got == 0) {
+		return false;
+	}
+	exitCode = got < 0 ? -1 : WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	worker.pid = -1;
+	return true;
+#endif
+}
+
+/*
+	Kills a started worker and waits for it, so nothing it writes can land after its results are collected.
+	- Pavel Shekhter
+*/
+static void killProcess(WORKER &worker) {
+#ifdef _WIN32
+	if (worker.process != NULL) {
+		TerminateProcess(worker.process, 1);
+		WaitForSingleObject(worker.process, INFINITE);
+		CloseHandle(worker.process);
+		worker.process = NULL;
+	}
+#else
+	if (worker.pid > 0) {
+		kill(worker.pid, SIGKILL);
+		waitpid(worker.pid, NULL, 0);
+		worker.pid = -1;
+	}
+#endif
+}
+
+/*
+	Kills the workers still running and removes their shared memory segments, when the coordinator gives up on a
+	trial. Workers on other hosts (--shard-launch=none) are left to time out on their own.
+	- Pavel Shekhter
+*/
+static void stopWorkers(std::vector<WORKER> &workers) {
+	for (size_t w = 0; w < workers.size(); ++w) {
+		WORKER &worker = workers[w];
+		killProcess(worker);
+		worker.running = false;
+		unmapSegment(worker.segment, worker.segmentName, true);
+	}
+}
+
+/*
+	Writes the shard file for the worker's remaining images and starts it, or with --shard-launch=none writes the
+	command line another host should run.
+	- Pavel Shekhter
+*/
+static bool launchWorker(std::ofstream &file, WORKER &worker, int trial, const std::vector<std::string> &imagefiles,
+	const std::vector<std::string> &forwarded, const std::string &program) {
+	worker.launches++;
+	worker.base = (boost::filesystem::path(opts.shardDir) / ("shard_" + std::to_string(worker.shard))).string();
+	std::string shardFile = worker.base + ".txt";
+	std::ofstream out(shardFile);
+	// A worker repeats each image as often as a single process would: once per image of the whole run
+	int repeats = (int)imagefiles.size();
+	out << "trial " << trial << "\n";
+	out << "repeats " << repeats << "\n";
+	out << "report " << worker.base << "_report.txt\n";
+	out << "csv " << worker.base << ".csv\n";
+	if (opts.shardTransport == SHARD_SHM) {
+		int count = (int)worker.images.size();
+		worker.segmentName = segmentName(worker.shard, worker.launches);
+		if (!mapSegment(worker.segment, worker.segmentName, segmentSize(count, repeats), true)) {
+			file << "Can't create shared memory segment " << worker.segmentName << "\n";
+			return false;
+		}
+		segmentHeader(worker.segment)->images = count;
+		segmentHeader(worker.segment)->repeats = repeats;
+		segmentHeader(worker.segment)->variants = variantCount;
+		out << "segment " << worker.segmentName << "\n";
+	}
+	else {
+		// A new name per launch: a worker on another host that timed out may still be writing the previous one
+		worker.resultsPath = worker.base + "_" + runId() + "_" + std::to_string(trial) + "_" + std::to_string(worker.launches) + ".results";
+		out << "results " << worker.resultsPath << "\n";
+	}
+	for (size_t i = 0; i < worker.images.size(); ++i) {
+		out << "image " << worker.images[i] << " " << imagefiles[worker.images[i]] << "\n";
+	}
+	out.close();
+	if (!out) {
+		appendErrorMessage(file, -3);
+		return false;
+	}
+
+	std::vector<std::string> args(forwarded);
+	args.push_back("--worker=" + shardFile);
+	worker.running = true;
+	worker.timedOut = false;
+	worker.started = nowMs();
+
+	if (!opts.launchWorkers) {
+		std::ofstream cmd(worker.base + ".cmd");
+		cmd << quoteArgument(program);
+		for (size_t i = 0; i < args.size(); ++i) {
+			cmd << " " << quoteArgument(args[i]);
+		}
+		cmd << "\n";
+		file << "Shard " << worker.shard << ": " << worker.images.size() << " images, run " << worker.base << ".cmd on a host sharing " << opts.shardDir << ".\n";
+		return true;
+	}
+
+	if (!startProcess(worker, args, program)) {
+		worker.running = false;
+		return false;
+	}
+	file << "Shard " << worker.shard << ": started a worker on " << worker.images.size() << " images.\n";
+	return true;
+}
+
+/*
+	Reads a results file into local (one entry per image of the shard). Returns true once the worker has written
+	its exit line.
+	- Pavel Shekhter
+*/
+static bool readResultsFile(const std::string &path, std::vector<SHARDRESULT> &local, int &exitCode) {
+	std::ifstream in(path);
+	std::string line;
+	bool exited = false;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		std::string key, variant;
+		int image = -1;
+		fields >> key;
+		if (key == "exit") {
+			fields >> exitCode;
+			exited = true;
+			continue;
+		}
+		fields >> image;
+		if (image < 0 || image >= (int)local.size()) {
+			continue;
+		}
+		if (key == "done") {
+			local[image].done = true;
+		}
+		else if (key == "detect") {
+			double ms = 0;
+			long long count = 0;
+			fields >> variant >> ms >> count;
+			const VARIANT *v = findVariant(variant);
+			if (v != NULL && fields) {
+				SHARDSLOT slot;
+				slot.ms = ms;
+				slot.count = count;
+				slot.recorded = 1;
+				local[image].samples[v - variants].push_back(slot);
+			}
+		}
+	}
+	return exited;
+}
+
+/*
+	Moves what the worker finished into results and drops those images from the worker's shard.
+	- Pavel Shekhter
+*/
+static void collectResults(WORKER &worker, std::vector<SHARDRESULT> &results) {
+	std::vector<SHARDRESULT> local(worker.images.size());
+	for (size_t i = 0; i < local.size(); ++i) {
+		local[i].samples.assign(variantCount, std::vector<SHARDSLOT>());
+	}
+
+	if (worker.segment.data != NULL) {
+		const int *done = segmentDone(worker.segment);
+		const SHARDSLOT *slots = segmentSlots(worker.segment);
+		int repeats = segmentHeader(worker.segment)->repeats;
+		for (size_t i = 0; i < local.size(); ++i) {
+			local[i].done = done[i] != 0;
+			for (int r = 0; r < repeats; ++r) {
+				for (int v = 0; v < variantCount; ++v) {
+					const SHARDSLOT &slot = slots[(i * repeats + r) * variantCount + v];
+					if (slot.recorded) {
+						local[i].samples[v].push_back(slot);
+					}
+				}
+			}
+		}
+		unmapSegment(worker.segment, worker.segmentName, true);
+	}
+	else {
+		int exitCode = 0;
+		readResultsFile(worker.resultsPath, local, exitCode);
+
+		// Only a timed out worker on another host can still be writing its file
+		if (opts.launchWorkers || !worker.timedOut) {
+			boost::system::error_code ec;
+			boost::filesystem::remove(worker.resultsPath, ec);
+		}
+	}
+
+	std::vector<int> remaining;
+	for (size_t i = 0; i < local.size(); ++i) {
+		if (local[i].done) {
+			results[worker.images[i]] = local[i];
+		}
+		else {
+			remaining.push_back(worker.images[i]);
+		}
+	}
+	worker.images = remaining;
+}
+
+/*
+	True once the worker is finished: its process exited, or with --shard-launch=none its results file ends with
+	an exit line, or --shard-timeout (required with --shard-launch=none) has run out. A started worker that times
+	out is killed first.
+	- Pavel Shekhter
+*/
+static bool workerFinished(WORKER &worker, int &exitCode) {
+	bool expired = opts.shardTimeout > 0 && nowMs() - worker.started > opts.shardTimeout * 1000;
+	if (opts.launchWorkers) {
+		if (processExited(worker, exitCode)) {
+			return true;
+		}
+		if (!expired) {
+			return false;
+		}
+		killProcess(worker);
+		worker.timedOut = true;
+		exitCode = -1;
+		return true;
+	}
+	std::vector<SHARDRESULT> local(worker.images.size());
+	for (size_t i = 0; i < local.size(); ++i) {
+		local[i].samples.assign(variantCount, std::vector<SHARDSLOT>());
+	}
+	if (readResultsFile(worker.resultsPath, local, exitCode)) {
+		return true;
+	}
+	if (expired) {
+		worker.timedOut = true;
+		exitCode = -1;
+		return true;
+	}
+	return false;
+}
+
+int runCoordinator(std::ofstream &file, const std::vector<std::string> &imagefiles, int cycles, const std::vector<std::string> &commandLine) {
+	if (!opts.launchWorkers && opts.shardTransport != SHARD_FILE) {
+		std::cout << "--shard-launch=none needs --shard-transport=file" << std::endl;
+		appendErrorMessage(file, -2);
+		return -2;
+	}
+	// Nothing tells the coordinator that a worker on another host died, so it only waits that long for a shard
+	if (!opts.launchWorkers && opts.shardTimeout <= 0) {
+		std::cout << "--shard-launch=none needs --shard-timeout=seconds" << std::endl;
+		appendErrorMessage(file, -2);
+		return -2;
+	}
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(opts.shardDir, ec);
+
+	std::vector<std::string> forwarded = workerOptions(commandLine);
+	std::string program = commandLine.empty() ? "CompVisionProject" : commandLine[0];
+	int workerCount = std::min(opts.workers, (int)imagefiles.size());
+	int restarts = 0, givenUp = 0;
+
+	for (int trial = 0; trial < cycles; ++trial) {
+		file << "Starting trial " << trial << "\n";
+		std::vector<SHARDRESULT> results(imagefiles.size());
+		std::vector<int> strikes(imagefiles.size(), 0);
+		std::vector<WORKER> workers(workerCount);
+		for (int w = 0; w < workerCount; ++w) {
+			workers[w].shard = w;
+			for (size_t i = imagefiles.size() * w / workerCount; i < imagefiles.size() * (w + 1) / workerCount; ++i) {
+				workers[w].images.push_back((int)i);
+			}
+			if (!launchWorker(file, workers[w], trial, imagefiles, forwarded, program)) {
+				stopWorkers(workers);
+				appendErrorMessage(file, -5);
+				return -5;
+			}
+		}
+
+		bool running = true;
+		while (running) {
+			running = false;
+			for (int w = 0; w < workerCount; ++w) {
+				WORKER &worker = workers[w];
+				int exitCode = 0;
+				if (!worker.running || !workerFinished(worker, exitCode)) {
+					running = running || worker.running;
+					continue;
+				}
+				worker.running = false;
+				collectResults(worker, results);
+				if (worker.images.empty()) {
+					file << "Shard " << w << ": finished with exit code " << exitCode << ".\n";
+					continue;
+				}
+
+				// A host that went quiet would cost a timeout per image if restarted, so its whole shard is given up on
+				if (!opts.launchWorkers && worker.timedOut) {
+					file << "Shard " << w << ": no exit line after " << opts.shardTimeout << " s; giving up on its " << worker.images.size()
+						<< " unfinished images, first " << imagefiles[worker.images[0]] << ".\n";
+					givenUp += (int)worker.images.size();
+					worker.images.clear();
+					continue;
+				}
+
+				// The worker runs its images in order, so the first unfinished one is the likely cause
+				int failing = worker.images[0];
+				if (worker.timedOut) {
+					file << "Shard " << w << ": worker timed out after " << opts.shardTimeout << " s";
+				}
+				else {
+					file << "Shard " << w << ": worker exited with code " << exitCode;
+				}
+				file << " with " << worker.images.size() << " images left, first " << imagefiles[failing] << ".\n";
+				if (++strikes[failing] >= maxStrikes) {
+					file << "Giving up on " << imagefiles[failing] << " after " << maxStrikes << " failed workers.\n";
+					worker.images.erase(worker.images.begin());
+					givenUp++;
+				}
+				if (worker.images.empty()) {
+					continue;
+				}
+				restarts++;
+				if (!launchWorker(file, worker, trial, imagefiles, forwarded, program)) {
+					stopWorkers(workers);
+					appendErrorMessage(file, -5);
+					return -5;
+				}
+				running = true;
+			}
+			if (running) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(opts.launchWorkers ? 50 : 1000));
+			}
+		}
+
+		// One run log row per repeat of each image, with the times the worker measured, as a single process logs them
+		for (size_t i = 0; i < imagefiles.size(); ++i) {
+			if (!results[i].done) {
+				continue;
+			}
+			size_t repeats = 0;
+			for (int v = 0; v < variantCount; ++v) {
+				repeats = std::max(repeats, results[i].samples[v].size());
+			}
+			for (size_t r = 0; r < repeats; ++r) {
+				setRunContext(trial, (int)i + 1, imagefiles[i]);
+				for (int v = 0; v < variantCount; ++v) {
+					if (r < results[i].samples[v].size()) {
+						const SHARDSLOT &slot = results[i].samples[v][r];
+						logStage(variants[v].name, "detect", runClock(), slot.ms, slot.count);
+					}
+				}
+			}
+		}
+		file << "Trial #" << trial << " ended.\n\n";
+	}
+
+	file << "Sharded over " << workerCount << " workers: " << restarts << " restarts, " << givenUp << " images given up on.\n";
+	return givenUp > 0 ? 1 : 0;
+}
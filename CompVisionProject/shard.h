@@ -0,0 +1,60 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+	Coordinator for --workers=N. Each trial splits the image files into N shards, writes a shard file per worker
+	under --shard-dir and starts the workers (this program with --worker=shard file), pinned to a NUMA node each
+	with --pin. A worker reports the detect time and contour count of every variant, and marks each image done as
+	it finishes, through shared memory or, with --shard-transport=file, a results file in --shard-dir. A worker that
+	crashes, fails or runs past --shard-timeout is killed and restarted on the images it had not finished; an image
+	that fails twice is given up on.
+	With --shard-launch=none nothing is started: the worker command lines are written next to the shard files for
+	other hosts sharing the directory, and the coordinator waits up to --shard-timeout, which is then required, for
+	their results files. A shard whose results file has no exit line by then has its unfinished images given up on
+	rather than restarted; each launch writes a results file of its own, so a late worker never overwrites a newer
+	one.
+	A worker repeats each image as often as a single process would, once per image of the whole run, and reports
+	every repeat; the coordinator logs a run log row per repeat, so the CSV rows and stage summary hold the same
+	samples as a single-process run. Only the start times in the report are the coordinator's.
+	commandLine is the coordinator's own argv; its options are passed on to the workers.
+	Returns 0 if every image was processed, 1 if some were given up on, or an error code as for appendErrorMessage;
+	if a worker cannot be started, the ones already running are killed before returning.
+	- Pavel Shekhter
+*/
+int runCoordinator(std::ofstream &file, const std::vector<std::string> &imagefiles, int cycles, const std::vector<std::string> &commandLine);
+
+/*
+	Opens the shard file of a worker: images becomes the program name followed by the shard's image files, and
+	trial, repeats (how many times each image is run), report and csv what the coordinator chose. Returns false if
+	the shard file or its transport cannot be opened.
+	- Pavel Shekhter
+*/
+bool openShard(const std::string &path, std::vector<char *> &images, int &trial, int &repeats, std::string &report, std::string &csv);
+
+/*
+	True in a worker opened with openShard.
+	- Pavel Shekhter
+*/
+bool shardWorker();
+
+/*
+	Reports one detect stage of a worker for the first unfinished image with this path, as the next repeat of its
+	variant.
+	- Pavel Shekhter
+*/
+void shardRecord(const std::string &imagefile, const std::string &variant, double ms, long long count);
+
+/*
+	Marks image (an index into the images openShard returned) as finished.
+	- Pavel Shekhter
+*/
+void shardImageDone(int image);
+
+/*
+	Ends the worker's results with its exit code and closes the transport.
+	- Pavel Shekhter
+*/
+void closeShard(int exitCode);
@@ -0,0 +1,275 @@
+/*
+	Smoothing engine for large kernels: a recursive Gaussian and a running-sum box filter whose cost per pixel does
+	not depend on the radius, so the blur can be swept for noisy low-light footage.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "main.h"
+#include "smoothing.h"
+
+/*
+	Columns of floats per task in the vertical pass of the recursive Gaussian.
+	- Pavel Shekhter
+*/
+static const int stripWidth = 256;
+
+/*
+	Smallest sigma the Young-van Vliet coefficients are accurate for.
+	- Pavel Shekhter
+*/
+static const double minRecursiveSigma = 0.5;
+
+static double gaussianSigma(int size, double sigma) {
+	return sigma > 0 ? sigma : 0.3 * ((size - 1) * 0.5 - 1) + 0.8;
+}
+
+static bool useConstantTime(int size) {
+	return opts.smoothEngine == ENGINE_CONSTANT || (opts.smoothEngine == ENGINE_AUTO && size >= opts.constantTimeFrom);
+}
+
+/*
+	Reflected (BORDER_REFLECT_101) indices for -pad .. len + pad, the border OpenCV's filters use.
+	- Pavel Shekhter
+*/
+static std::vector<int> reflectTable(int len, int pad) {
+	std::vector<int> table(len + 2 * pad + 1);
+	for (int i = -pad; i <= len + pad; ++i) {
+		table[i + pad] = cv::borderInterpolate(i, len, cv::BORDER_REFLECT_101);
+	}
+	return table;
+}
+
+/*
+	Running-sum box filter over a band of rows. Column sums over the 2r+1 rows are updated by adding the row that
+	enters the window and subtracting the one that leaves, a loop over all columns and channels that vectorizes;
+	a running sum along each row then gives the window total.
+	- Pavel Shekhter
+*/
+class BoxRows : public cv::ParallelLoopBody {
+public:
+	BoxRows(const cv::Mat &src, cv::Mat &dst, int radius) : src(src), dst(dst), radius(radius),
+		rowIndex(reflectTable(src.rows, radius + 1)), colIndex(reflectTable(src.cols, radius + 1)) {}
+
+	void operator()(const cv::Range &range) const {
+		int cn = src.channels();
+		int width = src.cols * cn;
+		int pad = radius + 1;
+		int area = (2 * radius + 1) * (2 * radius + 1);
+		std::vector<int> colSum(width, 0);
+
+		for (int d = -radius; d <= radius; ++d) {
+			const uchar *row = src.ptr(rowIndex[range.start + d + pad]);
+			for (int j = 0; j < width; ++j) {
+				colSum[j] += row[j];
+			}
+		}
+
+		for (int y = range.start; y < range.end; ++y) {
+			if (y > range.start) {
+				const uchar *enter = src.ptr(rowIndex[y + radius + pad]);
+				const uchar *leave = src.ptr(rowIndex[y - radius - 1 + pad]);
+				for (int j = 0; j < width; ++j) {
+					colSum[j] += enter[j] - leave[j];
+				}
+			}
+
+			uchar *out = dst.ptr(y);
+			for (int c = 0; c < cn; ++c) {
+				int sum = 0;
+				for (int d = -radius; d <= radius; ++d) {
+					sum += colSum[colIndex[d + pad] * cn + c];
+				}
+				for (int x = 0; x < src.cols; ++x) {
+					out[x * cn + c] = (uchar)((sum + area / 2) / area);
+					sum += colSum[colIndex[x + radius + 1 + pad] * cn + c] - colSum[colIndex[x - radius + pad] * cn + c];
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat &src;
+	cv::Mat &dst;
+	int radius;
+	std::vector<int> rowIndex;
+	std::vector<int> colIndex;
+};
+
+/*
+	Normalised coefficients of the third-order recursive Gaussian of Young and van Vliet:
+	w[n] = B x[n] + b1 w[n-1] + b2 w[n-2] + b3 w[n-3], run forwards and then backwards. B + b1 + b2 + b3 = 1, so
+	continuing the edge value past the border keeps a flat region flat.
+	- Pavel Shekhter
+*/
+struct YVVCOEFFS {
+	float B, b1, b2, b3;
+};
+
+static YVVCOEFFS yvvCoefficients(double sigma) {
+	double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * std::sqrt(1 - 0.26891 * sigma);
+	double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+	double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+	double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+	double b3 = 0.422205 * q * q * q;
+	YVVCOEFFS c;
+	c.b1 = (float)(b1 / b0);
+	c.b2 = (float)(b2 / b0);
+	c.b3 = (float)(b3 / b0);
+	c.B = 1 - c.b1 - c.b2 - c.b3;
+	return c;
+}
+
+/*
+	Recursive Gaussian along each row of a band, in place on the float image. Samples before the first and after
+	the last repeat the edge value; only the first three steps of each direction clamp their indices. Each step
+	needs the previous three, so this pass is serial along the row and only the column pass vectorizes.
+	- Pavel Shekhter
+*/
+class RecursiveRows : public cv::ParallelLoopBody {
+public:
+	RecursiveRows(cv::Mat &image, const YVVCOEFFS &c) : image(image), c(c) {}
+
+	void operator()(const cv::Range &range) const {
+		int cn = image.channels();
+		int n = image.cols;
+		for (int y = range.start; y < range.end; ++y) {
+			float *p = image.ptr<float>(y);
+			for (int ch = 0; ch < cn; ++ch) {
+				float *q = p + ch;
+				int head = std::min(3, n);
+				for (int x = 0; x < head; ++x) {
+					q[x * cn] = c.B * q[x * cn] + c.b1 * q[std::max(x - 1, 0) * cn] + c.b2 * q[std::max(x - 2, 0) * cn] +
+						c.b3 * q[std::max(x - 3, 0) * cn];
+				}
+				for (int x = head; x < n; ++x) {
+					q[x * cn] = c.B * q[x * cn] + c.b1 * q[(x - 1) * cn] + c.b2 * q[(x - 2) * cn] + c.b3 * q[(x - 3) * cn];
+				}
+
+				int tail = std::max(n - 3, 0);
+				for (int x = n - 1; x >= tail; --x) {
+					q[x * cn] = c.B * q[x * cn] + c.b1 * q[std::min(x + 1, n - 1) * cn] + c.b2 * q[std::min(x + 2, n - 1) * cn] +
+						c.b3 * q[std::min(x + 3, n - 1) * cn];
+				}
+				for (int x = tail - 1; x >= 0; --x) {
+					q[x * cn] = c.B * q[x * cn] + c.b1 * q[(x + 1) * cn] + c.b2 * q[(x + 2) * cn] + c.b3 * q[(x + 3) * cn];
+				}
+			}
+		}
+	}
+
+private:
+	cv::Mat &image;
+	YVVCOEFFS c;
+};
+
+/*
+	Recursive Gaussian down the columns of a strip, in place. Each step combines whole rows of the strip, so the
+	inner loop runs across columns and vectorizes.
+	- Pavel Shekhter
+*/
+class RecursiveColumns : public cv::ParallelLoopBody {
+public:
+	RecursiveColumns(cv::Mat &image, const YVVCOEFFS &c) : image(image), c(c) {}
+
+	void operator()(const cv::Range &range) const {
+		int width = image.cols * image.channels();
+		int n = image.rows;
+		for (int s = range.start; s < range.end; ++s) {
+			int first = s * stripWidth;
+			int last = std::min(width, first + stripWidth);
+			for (int y = 0; y < n; ++y) {
+				float *p = image.ptr<float>(y);
+				const float *p1 = image.ptr<float>(std::max(y - 1, 0));
+				const float *p2 = image.ptr<float>(std::max(y - 2, 0));
+				const float *p3 = image.ptr<float>(std::max(y - 3, 0));
+				for (int j = first; j < last; ++j) {
+					p[j] = c.B * p[j] + c.b1 * p1[j] + c.b2 * p2[j] + c.b3 * p3[j];
+				}
+			}
+			for (int y = n - 1; y >= 0; --y) {
+				float *p = image.ptr<float>(y);
+				const float *p1 = image.ptr<float>(std::min(y + 1, n - 1));
+				const float *p2 = image.ptr<float>(std::min(y + 2, n - 1));
+				const float *p3 = image.ptr<float>(std::min(y + 3, n - 1));
+				for (int j = first; j < last; ++j) {
+					p[j] = c.B * p[j] + c.b1 * p1[j] + c.b2 * p2[j] + c.b3 * p3[j];
+				}
+			}
+		}
+	}
+
+private:
+	cv::Mat &image;
+	YVVCOEFFS c;
+};
+
+static void recursiveGaussian(const cv::Mat &src, cv::Mat &dst, double sigma) {
+	cv::Mat image;
+	src.convertTo(image, CV_32F);
+	YVVCOEFFS c = yvvCoefficients(sigma);
+	cv::parallel_for_(cv::Range(0, image.rows), RecursiveRows(image, c));
+	int strips = (image.cols * image.channels() + stripWidth - 1) / stripWidth;
+	cv::parallel_for_(cv::Range(0, strips), RecursiveColumns(image, c));
+	image.convertTo(dst, src.type());
+}
+
+static void runningSumBox(const cv::Mat &src, cv::Mat &dst, int radius) {
+	// The bands read rows around their own, so filtering in place needs a copy of the input
+	cv::Mat input = src.data == dst.data ? src.clone() : src;
+	dst.create(src.size(), src.type());
+	// One band per thread: each band seeds its column sums over 2r+1 rows before it can slide them
+	cv::parallel_for_(cv::Range(0, src.rows), BoxRows(input, dst, radius), std::min(src.rows, cv::getNumThreads()));
+}
+
+bool smoothNeedsWholeImage(SMOOTHTYPE type, int size, double sigma) {
+	return type == SMOOTH_GAUSSIAN && useConstantTime(size) && gaussianSigma(size, sigma) >= minRecursiveSigma;
+}
+
+int smoothHalo(SMOOTHTYPE type, int size, double sigma) {
+	if (type == SMOOTH_NONE) {
+		return 0;
+	}
+	if (smoothNeedsWholeImage(type, size, sigma)) {
+		return (int)std::ceil(4 * gaussianSigma(size, sigma));
+	}
+	return size / 2;
+}
+
+void smoothImage(const cv::Mat &src, cv::Mat &dst, SMOOTHTYPE type, int size, double sigma) {
+	switch (type) {
+		case SMOOTH_GAUSSIAN:
+			if (smoothNeedsWholeImage(type, size, sigma)) {
+				recursiveGaussian(src, dst, gaussianSigma(size, sigma));
+			}
+			else {
+				cv::GaussianBlur(src, dst, cv::Size(size, size), sigma, sigma, cv::BORDER_DEFAULT);
+			}
+			break;
+		case SMOOTH_NORMALIZED_BOX:
+			if (useConstantTime(size)) {
+				runningSumBox(src, dst, size / 2);
+			}
+			else {
+				cv::blur(src, dst, cv::Size(size, size));
+			}
+			break;
+		case SMOOTH_BOX:
+			if (useConstantTime(size)) {
+				runningSumBox(src, dst, size / 2);
+			}
+			else {
+				cv::boxFilter(src, dst, -1, cv::Size(size, size), cv::Point(-1, -1), true, cv::BORDER_DEFAULT);
+			}
+			break;
+		case SMOOTH_NONE:
+			if (src.data != dst.data) {
+				src.copyTo(dst);
+			}
+			break;
+	}
+}
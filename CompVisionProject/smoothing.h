@@ -0,0 +1,27 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include "main.h"
+
+/*
+	Smooths an 8-bit image of any channel count with a size x size kernel. sigma is the Gaussian's; 0 derives it from
+	the size as OpenCV does. Small kernels use OpenCV's filters; from --constant-time-from on (or always with
+	--smooth-engine=constant) the Gaussian is a recursive Young-van Vliet filter and the box filters are running sums,
+	so the cost per pixel does not grow with the kernel. src and dst may be the same image.
+	- Pavel Shekhter
+*/
+void smoothImage(const cv::Mat &src, cv::Mat &dst, SMOOTHTYPE type, int size, double sigma);
+
+/*
+	True if smoothImage would use the recursive Gaussian, whose support is the whole image: such a result cannot be
+	reproduced by filtering a padded region of a larger image.
+	- Pavel Shekhter
+*/
+bool smoothNeedsWholeImage(SMOOTHTYPE type, int size, double sigma);
+
+/*
+	Pixels of neighbourhood smoothImage reads on each side; for the recursive Gaussian, where its weights fall below
+	one grey level.
+	- Pavel Shekhter
+*/
+int smoothHalo(SMOOTHTYPE type, int size, double sigma);
@@ -0,0 +1,198 @@
+/*
+	Thresholding and thinning post-stages for the detectors that do not produce a binary edge map themselves.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <cstdlib>
+#include "main.h"
+#include "thinning.h"
+#include "perfcounters.h"
+#include "runlog.h"
+
+/*
+	Marks the pixels of an 8-bit response that are strong enough to be edges.
+	- Pavel Shekhter
+*/
+static void strengthMask(const cv::Mat &response, cv::Mat &mask) {
+	if (opts.thinMode == THIN_OTSU) {
+		cv::threshold(response, mask, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+	}
+	else {
+		cv::adaptiveThreshold(response, mask, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, opts.thinBlock, -opts.thinOffset);
+	}
+}
+
+/*
+	Non-maximum suppression of the gradient magnitude over a band of rows. The gradient direction is quantised to
+	horizontal, vertical or one of the diagonals (tan 22.5 and tan 67.5 degrees as the boundaries), as in Canny.
+	- Pavel Shekhter
+*/
+class GradientSuppressor : public cv::ParallelLoopBody {
+public:
+	GradientSuppressor(const cv::Mat &magnitude, const cv::Mat &gradX, const cv::Mat &gradY, const cv::Mat &mask, cv::Mat &edges)
+		: magnitude(magnitude), gradX(gradX), gradY(gradY), mask(mask), edges(edges) {}
+
+	void operator()(const cv::Range &range) const {
+		for (int y = range.start; y < range.end; ++y) {
+			const uchar *above = magnitude.ptr(y - 1);
+			const uchar *row = magnitude.ptr(y);
+			const uchar *below = magnitude.ptr(y + 1);
+			const short *gx = gradX.ptr<short>(y);
+			const short *gy = gradY.ptr<short>(y);
+			const uchar *strong = mask.ptr(y);
+			uchar *out = edges.ptr(y);
+			for (int x = 1; x < magnitude.cols - 1; ++x) {
+				int m = row[x];
+				if (!strong[x] || m == 0) {
+					continue;
+				}
+				int ax = std::abs(gx[x]), ay = std::abs(gy[x]);
+				int before, after;
+				if (ay * 100 <= ax * 41) {
+					before = row[x - 1];
+					after = row[x + 1];
+				}
+				else if (ay * 100 >= ax * 241) {
+					before = above[x];
+					after = below[x];
+				}
+				else if ((gx[x] > 0) == (gy[x] > 0)) {
+					before = above[x - 1];
+					after = below[x + 1];
+				}
+				else {
+					before = above[x + 1];
+					after = below[x - 1];
+				}
+				if (m >= before && m > after) {
+					out[x] = 255;
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat &magnitude;
+	const cv::Mat &gradX;
+	const cv::Mat &gradY;
+	const cv::Mat &mask;
+	cv::Mat &edges;
+};
+
+/*
+	Zero crossings of the Laplacian over a band of rows. Where the sign changes between 4-neighbours the pixel nearer
+	zero is marked, so each crossing is one pixel wide; either side passing the threshold makes it an edge.
+	- Pavel Shekhter
+*/
+class ZeroCrossingFinder : public cv::ParallelLoopBody {
+public:
+	ZeroCrossingFinder(const cv::Mat &laplacian, const cv::Mat &mask, cv::Mat &edges)
+		: laplacian(laplacian), mask(mask), edges(edges) {}
+
+	void operator()(const cv::Range &range) const {
+		for (int y = range.start; y < range.end; ++y) {
+			const short *rows[3] = { laplacian.ptr<short>(y - 1), laplacian.ptr<short>(y), laplacian.ptr<short>(y + 1) };
+			const uchar *strong[3] = { mask.ptr(y - 1), mask.ptr(y), mask.ptr(y + 1) };
+			static const int dx[4] = { -1, 1, 0, 0 };
+			static const int dy[4] = { 0, 0, -1, 1 };
+			uchar *out = edges.ptr(y);
+			for (int x = 1; x < laplacian.cols - 1; ++x) {
+				int v = rows[1][x];
+				for (int n = 0; n < 4; ++n) {
+					int w = rows[1 + dy[n]][x + dx[n]];
+					if (((v < 0 && w > 0) || (v > 0 && w < 0) || (v == 0 && w != 0)) && std::abs(v) <= std::abs(w) &&
+						(strong[1][x] || strong[1 + dy[n]][x + dx[n]])) {
+						out[x] = 255;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat &laplacian;
+	const cv::Mat &mask;
+	cv::Mat &edges;
+};
+
+/*
+	Crests of a filter response over a band of rows: a strong pixel is kept if it is a maximum across its
+	horizontal, vertical or either diagonal neighbours.
+	- Pavel Shekhter
+*/
+class RidgeFinder : public cv::ParallelLoopBody {
+public:
+	RidgeFinder(const cv::Mat &response, const cv::Mat &mask, cv::Mat &edges)
+		: response(response), mask(mask), edges(edges) {}
+
+	void operator()(const cv::Range &range) const {
+		for (int y = range.start; y < range.end; ++y) {
+			const uchar *above = response.ptr(y - 1);
+			const uchar *row = response.ptr(y);
+			const uchar *below = response.ptr(y + 1);
+			const uchar *strong = mask.ptr(y);
+			uchar *out = edges.ptr(y);
+			for (int x = 1; x < response.cols - 1; ++x) {
+				int r = row[x];
+				if (!strong[x] || r == 0) {
+					continue;
+				}
+				if ((r >= row[x - 1] && r > row[x + 1]) || (r >= above[x] && r > below[x]) ||
+					(r >= above[x - 1] && r > below[x + 1]) || (r >= above[x + 1] && r > below[x - 1])) {
+					out[x] = 255;
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat &response;
+	const cv::Mat &mask;
+	cv::Mat &edges;
+};
+
+/*
+	Runs one thinning body over the interior rows, replaces response with its result and logs the stage from start.
+	- Pavel Shekhter
+*/
+static void runThinning(double start, cv::Mat &response, cv::Mat &edges, const cv::ParallelLoopBody &body) {
+	if (response.rows > 2 && response.cols > 2) {
+		cv::parallel_for_(cv::Range(1, response.rows - 1), body);
+	}
+	response = edges;
+	int edgePixels = cv::countNonZero(edges);
+	logStage("", "thin", start, runClock() - start, edgePixels);
+}
+
+void thinGradient(const cv::Mat &gradX, const cv::Mat &gradY, cv::Mat &magnitude) {
+	PERFSCOPE perf;
+	double start = runClock();
+	perfBegin(perf, "", "thin", (double)magnitude.total());
+	cv::Mat mask, edges = cv::Mat::zeros(magnitude.size(), CV_8UC1);
+	strengthMask(magnitude, mask);
+	runThinning(start, magnitude, edges, GradientSuppressor(magnitude, gradX, gradY, mask, edges));
+	perfEnd(perf);
+}
+
+void thinZeroCrossings(const cv::Mat &laplacian, cv::Mat &response) {
+	PERFSCOPE perf;
+	double start = runClock();
+	perfBegin(perf, "", "thin", (double)response.total());
+	cv::Mat mask, edges = cv::Mat::zeros(response.size(), CV_8UC1);
+	strengthMask(response, mask);
+	runThinning(start, response, edges, ZeroCrossingFinder(laplacian, mask, edges));
+	perfEnd(perf);
+}
+
+void thinRidges(cv::Mat &response) {
+	PERFSCOPE perf;
+	double start = runClock();
+	perfBegin(perf, "", "thin", (double)response.total());
+	cv::Mat mask, edges = cv::Mat::zeros(response.size(), CV_8UC1);
+	strengthMask(response, mask);
+	runThinning(start, response, edges, RidgeFinder(response, mask, edges));
+	perfEnd(perf);
+}
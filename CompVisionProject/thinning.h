@@ -0,0 +1,33 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include "main.h"
+
+/*
+	Post-stages that turn the raw 8-bit responses of the Sobel, Laplacian and Gabor detectors into a thin binary edge
+	map like Canny's, so findContours traces edges rather than every non-zero pixel. Only used with --thin; each
+	pixel first has to pass the --thin threshold (Otsu over the whole response, or adaptive against its
+	--thin-block neighbourhood). Output pixels are 0 or 255, and the one-pixel border is always 0.
+	- Pavel Shekhter
+*/
+
+/*
+	Sobel: keeps the pixels of the magnitude that are maxima along the gradient direction (non-maximum suppression).
+	gradX and gradY are the signed CV_16S gradients, magnitude the 8-bit response it replaces.
+	- Pavel Shekhter
+*/
+void thinGradient(const cv::Mat &gradX, const cv::Mat &gradY, cv::Mat &magnitude);
+
+/*
+	Laplacian: keeps the zero crossings of the signed CV_16S response, marking the side nearer zero.
+	response is the 8-bit absolute response it replaces.
+	- Pavel Shekhter
+*/
+void thinZeroCrossings(const cv::Mat &laplacian, cv::Mat &response);
+
+/*
+	Gabor: keeps the crests of the 8-bit response, the pixels that are a maximum across at least one of the four
+	principal directions.
+	- Pavel Shekhter
+*/
+void thinRidges(cv::Mat &response);
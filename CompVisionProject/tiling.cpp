@@ -0,0 +1,326 @@
+/*
+	Out-of-core tiled processing for inputs that do not fit in memory once multiplied by the IMAGEDATA buffers.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+#include "main.h"
+#include "tiling.h"
+#include "perfcounters.h"
+#include "runlog.h"
+#include "smoothing.h"
+
+/*
+	Estimated working set per tile pixel: the greyscale tile plus the Canny, Laplacian, Sobel and Gabor buffers
+	(several of them 16-bit or float) that IMAGEDATA holds for it.
+	- Pavel Shekhter
+*/
+static const int tileBytesPerPixel = 32;
+
+/*
+	An 8-bit binary PGM opened for random access by row.
+	- Pavel Shekhter
+*/
+struct PGMSTREAM {
+	std::fstream stream;
+	int width = 0;
+	int height = 0;
+	std::streamoff dataOffset = 0;
+};
+
+/*
+	Removes the greyscale spill file when runTiledImage returns, on the error paths as well. The stream reading it
+	is closed first, since Windows will not delete an open file.
+	- Pavel Shekhter
+*/
+struct SPILLFILE {
+	std::string path;
+	PGMSTREAM *input = NULL;
+	~SPILLFILE() {
+		if (path.empty()) {
+			return;
+		}
+		if (input != NULL) {
+			input->stream.close();
+		}
+		boost::system::error_code ec;
+		boost::filesystem::remove(path, ec);
+	}
+};
+
+/*
+	Peak resident memory of the process in bytes, since start or the last resetPeakResident.
+	- Pavel Shekhter
+*/
+static double peakResident() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return (double)counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0) {
+			return std::atof(line.c_str() + 6) * 1024;
+		}
+	}
+	return 0;
+#endif
+}
+
+/*
+	Resets the peak so the next reading covers only the stage that follows. Linux supports this through
+	clear_refs; elsewhere the reading stays the peak since process start.
+	- Pavel Shekhter
+*/
+static void resetPeakResident() {
+#ifndef _WIN32
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+#endif
+}
+
+/*
+	Reads the next header token of a PGM, skipping whitespace and comments.
+	- Pavel Shekhter
+*/
+static bool readPgmToken(std::istream &in, std::string &token) {
+	token.clear();
+	int c;
+	while ((c = in.get()) != EOF) {
+		if (c == '#') {
+			while ((c = in.get()) != EOF && c != '\n') {}
+		}
+		else if (!isspace(c)) {
+			token += (char)c;
+			break;
+		}
+	}
+	while ((c = in.peek()) != EOF && !isspace(c)) {
+		token += (char)in.get();
+	}
+	return !token.empty();
+}
+
+static bool openPgm(const std::string &path, PGMSTREAM &pgm) {
+	pgm.stream.open(path, std::ios::in | std::ios::binary);
+	std::string magic, width, height, maxval;
+	if (!readPgmToken(pgm.stream, magic) || magic != "P5" || !readPgmToken(pgm.stream, width) ||
+		!readPgmToken(pgm.stream, height) || !readPgmToken(pgm.stream, maxval) || std::atoi(maxval.c_str()) > 255) {
+		return false;
+	}
+	pgm.stream.get();
+	pgm.width = std::atoi(width.c_str());
+	pgm.height = std::atoi(height.c_str());
+	pgm.dataOffset = pgm.stream.tellg();
+	return pgm.width > 0 && pgm.height > 0;
+}
+
+static bool createPgm(const std::string &path, int width, int height, PGMSTREAM &pgm) {
+	{
+		std::ofstream create(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		create << "P5\n" << width << " " << height << "\n255\n";
+	}
+	pgm.stream.open(path, std::ios::in | std::ios::out | std::ios::binary);
+	pgm.stream.seekp(0, std::ios::end);
+	pgm.dataOffset = pgm.stream.tellp();
+	pgm.width = width;
+	pgm.height = height;
+
+	// Size the file up front so tiles can be written in any order
+	pgm.stream.seekp(pgm.dataOffset + (std::streamoff)width * height - 1);
+	pgm.stream.put('\0');
+	return pgm.stream.good();
+}
+
+static void readRegion(PGMSTREAM &pgm, const cv::Rect &region, cv::Mat &mat) {
+	mat.create(region.height, region.width, CV_8UC1);
+	for (int y = 0; y < region.height; ++y) {
+		pgm.stream.seekg(pgm.dataOffset + (std::streamoff)(region.y + y) * pgm.width + region.x);
+		pgm.stream.read((char *)mat.ptr(y), region.width);
+	}
+}
+
+static void writeRegion(PGMSTREAM &pgm, const cv::Rect &region, const cv::Mat &mat) {
+	for (int y = 0; y < region.height; ++y) {
+		pgm.stream.seekp(pgm.dataOffset + (std::streamoff)(region.y + y) * pgm.width + region.x);
+		pgm.stream.write((const char *)mat.ptr(y), region.width);
+	}
+}
+
+/*
+	Halo each tile needs so the detectors see the same neighbourhood at the core's edges as on the whole image:
+	the widest smoothing of the chosen variants, the Canny/Sobel/Laplacian apertures, when Gabor runs half its kernel,
+	and with --thin the thinning neighbourhood (the whole adaptive block). An Otsu threshold is still chosen per tile,
+	and a recursive Gaussian only gets the 4 sigma where its weights become negligible.
+	- Pavel Shekhter
+*/
+static int tileOverlap(const std::vector<const VARIANT *> &chosen) {
+	if (opts.tileOverlap > 0) {
+		return opts.tileOverlap;
+	}
+	int smoothing = 0;
+	for (size_t v = 0; v < chosen.size(); ++v) {
+		int size;
+		double sigma;
+		SMOOTHTYPE type = variantSmoothing(*chosen[v], size, sigma);
+		smoothing = std::max(smoothing, smoothHalo(type, size, sigma));
+	}
+	int overlap = smoothing + std::max(id.canny_Kernel, id.laplace_kernel) / 2 + 2;
+	for (size_t v = 0; v < chosen.size(); ++v) {
+		if (chosen[v]->detect == &gabor) {
+			overlap += id.gaborKernelSize / 2;
+		}
+	}
+	if (opts.thinMode == THIN_ADAPTIVE) {
+		overlap += opts.thinBlock / 2 + 1;
+	}
+	else if (opts.thinMode == THIN_OTSU) {
+		overlap += 1;
+	}
+	return overlap;
+}
+
+int runTiledImage(std::ofstream &file, const std::string &imagefile, int trial) {
+	std::vector<const VARIANT *> chosen;
+	if (!parseVariantList(opts.variantList, chosen)) {
+		appendErrorMessage(file, -2);
+		return -2;
+	}
+
+	double runStart = runClock();
+	std::map<std::string, double> stagePeaks;
+	boost::filesystem::path imagePath(imagefile);
+
+	// Stream PGM input directly; anything else is decoded once and spilled to disk as PGM
+	std::string source = imagefile;
+	PGMSTREAM input;
+	SPILLFILE spill;
+	if (!openPgm(source, input)) {
+		resetPeakResident();
+		file << "Decoding " << imagefile << " to a greyscale spill file.\n";
+		cv::Mat whole = cv::imread(imagefile, decodeFlag(true, opts.analysisScale));
+		if (whole.empty()) {
+			std::cout << "Can't open file!" << std::endl;
+			appendErrorMessage(file, -1);
+			return -1;
+		}
+		source = "spill_" + imagePath.stem().generic_string() + ".pgm";
+		spill.path = source;
+		spill.input = &input;
+		if (!cv::imwrite(source, whole)) {
+			appendErrorMessage(file, -3);
+			return -3;
+		}
+		whole.release();
+		stagePeaks["decode"] = peakResident();
+
+		input = PGMSTREAM();
+		if (!openPgm(source, input)) {
+			appendErrorMessage(file, -1);
+			return -1;
+		}
+	}
+
+	int overlap = tileOverlap(chosen);
+	double budget = opts.tileBudgetMB * 1024.0 * 1024.0;
+	int side = (int)std::sqrt(budget / tileBytesPerPixel) - 2 * overlap;
+	if (side < 64) {
+		file << "Memory budget of " << opts.tileBudgetMB << " MB is too small for tiles with a " << overlap << " pixel overlap.\n";
+		appendErrorMessage(file, -2);
+		return -2;
+	}
+
+	file << "Tiled processing of " << imagefile << " (" << input.width << "x" << input.height << ") in " << side << "x" << side
+		<< " tiles with a " << overlap << " pixel overlap.\n";
+
+	std::vector<PGMSTREAM> outputs(chosen.size());
+	for (size_t v = 0; v < chosen.size(); ++v) {
+		std::string outName = "trial_" + std::to_string(trial) + "_" + chosen[v]->name + "_tiled_" + imagePath.stem().generic_string() + ".pgm";
+		if (!createPgm(outName, input.width, input.height, outputs[v])) {
+			appendErrorMessage(file, -3);
+			return -3;
+		}
+	}
+
+	// Each tile's contour and thinning records are summed per variant when the report is written
+	std::vector<double> times(chosen.size(), 0);
+	std::vector<long long> contours(chosen.size(), 0), points(chosen.size(), 0);
+	cv::Mat tile, work, det, noColor;
+	int tiles = 0;
+	cv::Rect bounds(0, 0, input.width, input.height);
+
+	for (int ty = 0; ty < input.height; ty += side) {
+		for (int tx = 0; tx < input.width; tx += side) {
+			cv::Rect core(tx, ty, std::min(side, input.width - tx), std::min(side, input.height - ty));
+			cv::Rect outer = cv::Rect(core.x - overlap, core.y - overlap, core.width + 2 * overlap, core.height + 2 * overlap) & bounds;
+
+			resetPeakResident();
+			readRegion(input, outer, tile);
+			stagePeaks["read"] = std::max(stagePeaks["read"], peakResident());
+
+			for (size_t v = 0; v < chosen.size(); ++v) {
+				tile.copyTo(work);
+				id.currentFrameColor.release();
+				id.currentFrameGry = work;
+				id.contourRegion = cv::Rect(core.x - outer.x, core.y - outer.y, core.width, core.height);
+				setRunVariant(chosen[v]->name);
+
+				resetPeakResident();
+				double initTime = (cv::getTickCount()) / (cv::getTickFrequency());
+				PERFSCOPE perf;
+				perfBegin(perf, chosen[v]->name, "tile", (double)work.total());
+				chosen[v]->detect(const_cast<char *>(imagefile.c_str()), det, noColor);
+				perfEnd(perf);
+				double finalTime = (cv::getTickCount()) / (cv::getTickFrequency());
+				stagePeaks[chosen[v]->name] = std::max(stagePeaks[chosen[v]->name], peakResident());
+
+				times[v] += (finalTime - initTime) * 1000;
+				contours[v] += id.contourCount;
+				points[v] += id.contourPoints;
+
+				resetPeakResident();
+				writeRegion(outputs[v], core, det(id.contourRegion));
+				stagePeaks["write"] = std::max(stagePeaks["write"], peakResident());
+			}
+			tiles++;
+		}
+	}
+	id.contourRegion = cv::Rect();
+
+	file << "Processed " << tiles << " tiles.\n";
+	for (size_t v = 0; v < chosen.size(); ++v) {
+		file << chosen[v]->name << " took " << times[v] << " ms over all tiles and found " << contours[v] << " contours with "
+			<< points[v] << " points.\n";
+	}
+	file << "Peak resident memory by stage:\n";
+	for (std::map<std::string, double>::const_iterator it = stagePeaks.begin(); it != stagePeaks.end(); ++it) {
+		file << "  " << it->first << ": " << it->second / (1024 * 1024) << " MB\n";
+	}
+
+	for (size_t v = 0; v < chosen.size(); ++v) {
+		logStage(chosen[v]->name, "detect", runStart, times[v], contours[v]);
+	}
+	return 0;
+}
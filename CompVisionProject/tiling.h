@@ -0,0 +1,17 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+
+/*
+	Runs the --variants detectors over an image too large to hold in memory (--tile-budget=MB).
+	The image is streamed from disk in overlapping tiles sized to the budget; binary PGM input is read in place and
+	other formats are decoded once to greyscale and spilled to a PGM next to the report. Each variant's edge map is
+	stitched into trial_<n>_<variant>_tiled_<image>.pgm, and a contour is counted by the tile whose core holds its
+	first point. A contour crossing a core boundary is traced once per tile it reaches, and each trace may start in
+	its own core, so the contour totals are approximate. The report gets the totals and the peak resident memory of each stage, and the run log one "detect"
+	record per variant with its time over all tiles.
+	Returns 0, or the error code on failure.
+	- Pavel Shekhter
+*/
+int runTiledImage(std::ofstream &file, const std::string &imagefile, int trial);
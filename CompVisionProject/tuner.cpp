@@ -0,0 +1,390 @@
+/*
+	Auto-tuner for the edge detector variants and their parameters.
+	- Pavel Shekhter
+*/
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "main.h"
+#include "tuner.h"
+#include "thinning.h"
+
+typedef std::vector<std::pair<std::string, std::string> > SETTINGS;
+
+/*
+	One configuration under evaluation, with its running totals over the sample images it has seen so far.
+	- Pavel Shekhter
+*/
+struct TUNECANDIDATE {
+	const VARIANT *variant;
+	SETTINGS settings;
+	int images = 0;
+	double time = 0;       // ms, detector plus contour tracing
+	double quality = 0;    // sum of F1 scores
+	bool dropped = false;  // stopped early for being far slower than the best configuration so far
+
+	double meanTime() const { return images ? time / images : 0; }
+	double meanQuality() const { return images ? quality / images : 0; }
+};
+
+/*
+	A sample image: its pristine greyscale frame and the reference edges, as is and dilated by one pixel.
+	- Pavel Shekhter
+*/
+struct TUNESAMPLE {
+	cv::Mat frame;
+	cv::Mat reference;
+	cv::Mat referenceNear;
+};
+
+static const char *thinSettings[] = { "none", "otsu", "adaptive" };
+
+/*
+	Sigma of the Gaussian in the Laplacian-of-Gaussian reference.
+	- Pavel Shekhter
+*/
+static const double referenceSigma = 2.0;
+
+/*
+	A candidate is dropped when its mean time is this many times that of the fastest configuration meeting the target.
+	- Pavel Shekhter
+*/
+static const double dropFactor = 2.0;
+
+static double nowMs() {
+	return (cv::getTickCount()) / (cv::getTickFrequency()) * 1000;
+}
+
+static SETTINGS setting(const SETTINGS &base, const std::string &key, const std::string &value) {
+	SETTINGS settings = base;
+	settings.push_back(std::make_pair(key, value));
+	return settings;
+}
+
+static std::string describe(const TUNECANDIDATE &candidate) {
+	std::string text = candidate.variant->name;
+	for (size_t i = 0; i < candidate.settings.size(); ++i) {
+		text += " " + candidate.settings[i].first + "=" + candidate.settings[i].second;
+	}
+	return text;
+}
+
+/*
+	Applies one setting to id and opts. Returns false if the key is unknown.
+	- Pavel Shekhter
+*/
+static bool applySetting(const std::string &key, const std::string &value) {
+	if (key == "thin") {
+		if (value == "none") opts.thinMode = THIN_NONE;
+		else if (value == "otsu") opts.thinMode = THIN_OTSU;
+		else if (value == "adaptive") opts.thinMode = THIN_ADAPTIVE;
+		else return false;
+		return true;
+	}
+	return setParameter(id, key, value);
+}
+
+/*
+	Lists the search space: every variant (and so every blur type) crossed with the parameters that variant uses,
+	including the blur size of its family and, for the Gaussian variants, the blur sigma.
+	- Pavel Shekhter
+*/
+static void buildCandidates(std::vector<TUNECANDIDATE> &candidates) {
+	static const char *cannyLow[] = { "10", "20", "40", "60", "80", "100" };
+	static const char *cannyRatio[] = { "2", "3" };
+	static const char *cannyKernel[] = { "3", "5" };
+	static const char *laplaceKernel[] = { "1", "3", "5" };
+	static const char *sobelScale[] = { "1", "2" };
+	static const char *gaborSize[] = { "15", "31" };
+	static const char *gaborSig[] = { "2", "4" };
+	static const char *gaborLm[] = { "6", "10" };
+	static const char *blurSize[] = { "3", "5", "9" };
+	static const char *blurSigma[] = { "0", "2" };  // 0 derives sigma from the size
+
+	std::vector<std::pair<const VARIANT *, SETTINGS> > space;
+	for (int v = 0; v < variantCount; ++v) {
+		const VARIANT *variant = &variants[v];
+		std::vector<SETTINGS> options(1);
+		if (variant->detect == &gaussianCanny || variant->detect == &normalizedCanny || variant->detect == &boxCanny) {
+			std::vector<SETTINGS> next;
+			for (size_t a = 0; a < 6; ++a)
+				for (size_t b = 0; b < 2; ++b)
+					for (size_t c = 0; c < 2; ++c)
+						next.push_back(setting(setting(setting(SETTINGS(), "canny_lowThresh", cannyLow[a]), "canny_Ratio", cannyRatio[b]), "canny_Kernel", cannyKernel[c]));
+			options = next;
+		}
+		else {
+			std::vector<SETTINGS> next;
+			if (variant->detect == &gabor) {
+				for (size_t a = 0; a < 2; ++a)
+					for (size_t b = 0; b < 2; ++b)
+						for (size_t c = 0; c < 2; ++c)
+							next.push_back(setting(setting(setting(SETTINGS(), "gaborKernelSize", gaborSize[a]), "gaborSig", gaborSig[b]), "gaborLm", gaborLm[c]));
+			}
+			else if (variant->detect == &gaussianSobel || variant->detect == &normalizedSobel || variant->detect == &boxSobel) {
+				for (size_t a = 0; a < 2; ++a)
+					next.push_back(setting(SETTINGS(), "sobel_scale", sobelScale[a]));
+			}
+			else {
+				for (size_t a = 0; a < 3; ++a)
+					next.push_back(setting(SETTINGS(), "laplace_kernel", laplaceKernel[a]));
+			}
+
+			// The responses of these variants are only comparable to a thin reference once thinned
+			options.clear();
+			for (size_t i = 0; i < next.size(); ++i)
+				for (size_t t = 0; t < 3; ++t)
+					options.push_back(setting(next[i], "thin", thinSettings[t]));
+		}
+
+		// Each family's own blur; Gabor smooths nothing
+		if (variant->detect != &gabor) {
+			int size;
+			double sigma;
+			SMOOTHTYPE smooth = variantSmoothing(*variant, size, sigma);
+			std::string family = std::string(variant->name).substr(0, std::string(variant->name).find('_'));
+			std::vector<SETTINGS> next;
+			for (size_t i = 0; i < options.size(); ++i)
+				for (size_t a = 0; a < 3; ++a)
+					for (size_t b = 0; b < (smooth == SMOOTH_GAUSSIAN ? 2u : 1u); ++b) {
+						SETTINGS blurred = setting(options[i], family + "_blurSize", blurSize[a]);
+						next.push_back(smooth == SMOOTH_GAUSSIAN ? setting(blurred, family + "_blurSigma", blurSigma[b]) : blurred);
+					}
+			options = next;
+		}
+
+		for (size_t i = 0; i < options.size(); ++i) {
+			TUNECANDIDATE candidate;
+			candidate.variant = variant;
+			candidate.settings = options[i];
+			candidates.push_back(candidate);
+		}
+	}
+}
+
+/*
+	Reference edges: zero crossings of the Laplacian of a Gaussian-smoothed frame, kept where the response passes an
+	Otsu threshold.
+	- Pavel Shekhter
+*/
+static void referenceEdges(const cv::Mat &frame, cv::Mat &reference) {
+	cv::Mat smoothed, laplacian;
+	cv::GaussianBlur(frame, smoothed, cv::Size(0, 0), referenceSigma, referenceSigma, cv::BORDER_DEFAULT);
+	cv::Laplacian(smoothed, laplacian, CV_16S, 3, 1, 0, cv::BORDER_DEFAULT);
+	cv::convertScaleAbs(laplacian, reference);
+
+	THINMODE thinMode = opts.thinMode;
+	opts.thinMode = THIN_OTSU;
+	thinZeroCrossings(laplacian, reference);
+	opts.thinMode = thinMode;
+}
+
+/*
+	F1 score of an edge map against the reference, counting an edge pixel as matched if the other map has an edge
+	within one pixel of it.
+	- Pavel Shekhter
+*/
+static double edgeQuality(const cv::Mat &edges, const TUNESAMPLE &sample) {
+	cv::Mat found, foundNear, matched;
+	cv::compare(edges, 0, found, cv::CMP_GT);
+	cv::dilate(found, foundNear, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+
+	int foundCount = cv::countNonZero(found);
+	int referenceCount = cv::countNonZero(sample.reference);
+	if (foundCount == 0 || referenceCount == 0) {
+		return foundCount == referenceCount ? 1.0 : 0.0;
+	}
+	cv::bitwise_and(found, sample.referenceNear, matched);
+	double precision = (double)cv::countNonZero(matched) / foundCount;
+	cv::bitwise_and(sample.reference, foundNear, matched);
+	double recall = (double)cv::countNonZero(matched) / referenceCount;
+	return precision + recall > 0 ? 2 * precision * recall / (precision + recall) : 0.0;
+}
+
+/*
+	Runs a candidate on one sample image from its pristine frame, without a colour plane so nothing is drawn.
+	A candidate with a setting that cannot be applied is dropped without being timed.
+	- Pavel Shekhter
+*/
+static void evaluate(TUNECANDIDATE &candidate, const TUNESAMPLE &sample, const IMAGEDATA &defaults, THINMODE defaultThin) {
+	static cv::Mat work;
+	cv::Mat det, noColor;
+
+	copyParameters(defaults, id);
+	opts.thinMode = defaultThin;
+	for (size_t i = 0; i < candidate.settings.size(); ++i) {
+		if (!applySetting(candidate.settings[i].first, candidate.settings[i].second)) {
+			printf("Skipping %s: bad setting %s.\n", describe(candidate).c_str(), candidate.settings[i].first.c_str());
+			candidate.dropped = true;
+			return;
+		}
+	}
+
+	sample.frame.copyTo(work);
+	id.currentFrameColor.release();
+	id.currentFrameGry = work;
+
+	double start = nowMs();
+	candidate.variant->detect(const_cast<char *>("tune"), det, noColor);
+	candidate.time += nowMs() - start;
+	candidate.quality += edgeQuality(det, sample);
+	candidate.images++;
+}
+
+/*
+	Orders candidates best first: those meeting the quality target by time, then the rest by quality.
+	- Pavel Shekhter
+*/
+static bool betterCandidate(const TUNECANDIDATE &a, const TUNECANDIDATE &b) {
+	bool aMeets = !a.dropped && a.meanQuality() >= opts.tuneQuality;
+	bool bMeets = !b.dropped && b.meanQuality() >= opts.tuneQuality;
+	if (aMeets != bMeets) {
+		return aMeets;
+	}
+	if (aMeets) {
+		return a.meanTime() < b.meanTime();
+	}
+	if (a.dropped != b.dropped) {
+		return !a.dropped;
+	}
+	return a.meanQuality() > b.meanQuality();
+}
+
+static bool writeProfile(const TUNECANDIDATE &best, int sampleCount) {
+	std::ofstream profile(opts.tuneProfile);
+	if (!profile.is_open()) {
+		return false;
+	}
+	profile << "# Auto-tuned on " << best.images << " of " << sampleCount << " sample images: " << best.meanTime() << " ms per image, edge quality "
+		<< best.meanQuality() << " (target " << opts.tuneQuality << ")\n";
+	profile << "variant=" << best.variant->name << "\n";
+	for (size_t i = 0; i < best.settings.size(); ++i) {
+		profile << best.settings[i].first << "=" << best.settings[i].second << "\n";
+	}
+	return profile.good();
+}
+
+int runTuner(const std::vector<std::string> &imagefiles) {
+	double start = nowMs();
+	double budget = opts.tuneBudget * 1000;
+
+	std::vector<TUNESAMPLE> samples(imagefiles.size());
+	for (size_t i = 0; i < imagefiles.size(); ++i) {
+		samples[i].frame = cv::imread(imagefiles[i], decodeFlag(true, opts.analysisScale));
+		if (samples[i].frame.empty()) {
+			std::cout << "Can't open " << imagefiles[i] << std::endl;
+			appendErrorMessage(std::cout, -1);
+			return -1;
+		}
+		referenceEdges(samples[i].frame, samples[i].reference);
+		cv::dilate(samples[i].reference, samples[i].referenceNear, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)));
+	}
+
+	const IMAGEDATA defaults = id;
+	const THINMODE defaultThin = opts.thinMode;
+	std::vector<TUNECANDIDATE> candidates;
+	buildCandidates(candidates);
+	printf("Tuning %d configurations on %d images (budget %.0f s, quality target %.3f).\n", (int)candidates.size(),
+		(int)samples.size(), opts.tuneBudget, opts.tuneQuality);
+
+	// Successive halving: each rung doubles the images the survivors are measured on and keeps the better half
+	std::vector<TUNECANDIDATE> survivors = candidates;
+	size_t rungImages = 1;
+	bool outOfTime = false;
+	for (int rung = 0; !outOfTime; ++rung) {
+		rungImages = std::min(rungImages, samples.size());
+		double fastest = 0;
+		for (size_t c = 0; c < survivors.size() && !outOfTime; ++c) {
+			TUNECANDIDATE &candidate = survivors[c];
+			while (candidate.images < (int)rungImages && !candidate.dropped) {
+				if (nowMs() - start > budget) {
+					outOfTime = true;
+					break;
+				}
+				evaluate(candidate, samples[candidate.images], defaults, defaultThin);
+				if (fastest > 0 && candidate.meanTime() > dropFactor * fastest) {
+					candidate.dropped = true;
+				}
+			}
+			if (candidate.images == (int)rungImages && !candidate.dropped && candidate.meanQuality() >= opts.tuneQuality &&
+				(fastest == 0 || candidate.meanTime() < fastest)) {
+				fastest = candidate.meanTime();
+			}
+		}
+
+		std::stable_sort(survivors.begin(), survivors.end(), betterCandidate);
+		printf("Rung %d: %d configurations on %d images, best %s (%.3f ms, quality %.3f).\n", rung, (int)survivors.size(),
+			(int)rungImages, describe(survivors[0]).c_str(), survivors[0].meanTime(), survivors[0].meanQuality());
+
+		if (survivors.size() == 1 && rungImages == samples.size()) {
+			break;
+		}
+		if (!outOfTime) {
+			survivors.resize(std::max<size_t>(1, (survivors.size() + 1) / 2));
+			rungImages *= 2;
+		}
+	}
+	if (outOfTime) {
+		printf("Time budget used up; choosing from the configurations measured so far.\n");
+	}
+
+	copyParameters(defaults, id);
+	opts.thinMode = defaultThin;
+
+	const TUNECANDIDATE &best = survivors[0];
+	if (best.dropped || best.meanQuality() < opts.tuneQuality) {
+		printf("No configuration reached quality %.3f; the best was %s at %.3f.\n", opts.tuneQuality, describe(best).c_str(), best.meanQuality());
+		return 1;
+	}
+	if (!writeProfile(best, (int)samples.size())) {
+		appendErrorMessage(std::cout, -3);
+		return -3;
+	}
+	printf("Fastest configuration meeting the target: %s, %.3f ms per image, quality %.3f. Written to %s (%.1f s).\n",
+		describe(best).c_str(), best.meanTime(), best.meanQuality(), opts.tuneProfile.c_str(), (nowMs() - start) / 1000);
+	return 0;
+}
+
+bool loadProfile(const std::string &path) {
+	std::ifstream profile(path);
+	if (!profile.is_open()) {
+		std::cout << "Can't open profile " << path << std::endl;
+		return false;
+	}
+
+	std::string line;
+	while (std::getline(profile, line)) {
+		if (!line.empty() && line[line.size() - 1] == '\r') {
+			line.erase(line.size() - 1);
+		}
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		size_t eq = line.find('=');
+		if (eq == std::string::npos) {
+			std::cout << "Bad profile line: " << line << std::endl;
+			return false;
+		}
+		std::string key = line.substr(0, eq);
+		std::string value = line.substr(eq + 1);
+		if (key == "variant") {
+			std::vector<const VARIANT *> chosen;
+			if (!parseVariantList(value, chosen)) {
+				return false;
+			}
+			opts.variantList = value;
+		}
+		else if (!applySetting(key, value)) {
+			std::cout << "Unknown profile setting: " << key << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
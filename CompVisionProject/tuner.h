@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+	Searches the variants and their parameters (kernel sizes, Canny thresholds, Gabor settings, --thin) for the
+	fastest configuration whose edges agree with a Laplacian-of-Gaussian reference at least as well as
+	--tune-quality, measured as the F1 score with a one-pixel tolerance. Successive halving evaluates every
+	configuration on one sample image, keeps the better half, doubles the images and repeats, and stops early when
+	--tune-budget seconds run out. The winner is written to opts.tuneProfile for --profile.
+	Returns 0 if a configuration met the target, 1 if none did, or an error code as for appendErrorMessage.
+	- Pavel Shekhter
+*/
+int runTuner(const std::vector<std::string> &imagefiles);
+
+/*
+	Loads a profile written by runTuner: "key=value" lines with a variant, detector parameters as for setParameter,
+	and a thin mode. The variant becomes the --variants list; the parameters replace the defaults in id. main loads it
+	before parsing the other options, so --variants, --thin and --blur given on the command line override it.
+	Returns false if the file cannot be read or holds an unknown key.
+	- Pavel Shekhter
+*/
+bool loadProfile(const std::string &path);